@@ -0,0 +1,29 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* The estimators that reduce the samples of the rounds of a cache line to a
+ * single timing.
+ */
+enum aggregator {
+	AGGREGATE_MEDIAN,
+	AGGREGATE_REMEDIAN,
+	AGGREGATE_TRIMMED_MEAN,
+	AGGREGATE_MIN,
+	AGGREGATE_MODE,
+	AGGREGATE_NMODES,
+};
+
+int get_aggregator(const char *name);
+const char *get_aggregator_name(int aggregator);
+void list_aggregators(FILE *f);
+void sort_samples(uint64_t *samples, size_t n);
+uint64_t select_sample(uint64_t *samples, size_t n, size_t k);
+uint64_t aggregate(uint64_t *samples, size_t n, int aggregator);
@@ -33,7 +33,32 @@ enum {
 	OPTION_TARGET,
 	OPTION_EVICT_TARGET,
 	OPTION_THRESHOLD,
+	OPTION_EVICT_SETS,
+	OPTION_EVICT_MODE,
+	OPTION_EVICT_BENCH,
+	OPTION_EVICT_HUGEPAGES,
+	OPTION_SPARSE,
+	OPTION_WARMUP,
+	OPTION_TIMER,
+	OPTION_LIST_TIMERS,
+	OPTION_TIMER_CPU,
+	OPTION_TIMER_NS,
+	OPTION_SERIALIZE,
+	OPTION_AGGREGATE,
+	OPTION_SOLVER_THREADS,
+	OPTION_CONFIDENCE,
+	OPTION_SAMPLE_BUDGET,
+	OPTION_EARLY_STOP,
+	OPTION_SCORE,
+	OPTION_THREADS,
+	OPTION_CORES,
+	OPTION_SAVE_TIMINGS,
+	OPTION_CAPTURE,
+	OPTION_CAPTURE_CPU,
+	OPTION_CONTROL_LINES,
+	OPTION_SPRT_ERROR,
 	OPTION_OUTPUT = 'o',
+	OPTION_INPUT = 'i',
 };
 
 struct args {
@@ -43,12 +68,36 @@ struct args {
 	size_t cache_size;
 	size_t line_size;
 	size_t nrounds;
+	size_t nwarmup;
+	size_t nsolver_threads;
+	size_t nthreads;
+	size_t ncores;
+	size_t sample_budget;
+	size_t ncontrol_lines;
 	size_t nruns;
 	float threshold;
+	double confidence;
+	double error_rate;
+	double sprt_error;
 	uintptr_t target;
 	uintptr_t evict_target;
 	char *output;
+	char *input;
 	unsigned int cpu;
+	int evict_sets;
+	int evict_mode;
+	int evict_bench;
+	int evict_hugepages;
+	int sparse;
+	int timer;
+	int timer_cpu;
+	int timer_ns;
+	int serialize;
+	int score;
+	int record_formats;
+	int capture;
+	int capture_cpu;
+	int aggregators[4];
 };
 
 int parse_size(size_t *size, const char *s);
@@ -8,23 +8,31 @@
 #include <stdint.h>
 
 #include "config.h"
+#include "macros.h"
 
-typedef uint64_t cycles_t;
+enum serialize_mode {
+	SERIALIZE_ISB,
+	SERIALIZE_NMODES,
+};
 
-extern volatile cycles_t timer_cycles;
+extern const char *serialize_modes[];
+extern int serialize_mode;
 
-static inline void code_barrier(void)
+static always_inline void code_barrier(void)
 {
 	asm volatile("isb\n");
 }
 
-static inline void data_barrier(void)
+static always_inline void data_barrier(void)
 {
 	asm volatile("dsb sy\n" ::: "memory");
 }
 
-static inline cycles_t rdtsc(void)
+static always_inline uint64_t cntvct(void)
 {
-	return timer_cycles;
-}
+	uint64_t ticks;
+
+	asm volatile("isb\nmrs %0, cntvct_el0\n" : "=r" (ticks));
 
+	return ticks;
+}
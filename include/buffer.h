@@ -7,13 +7,23 @@
 
 #include <stdlib.h>
 
+#include "macros.h"
+#include "sparse.h"
+
 struct page_format;
 
+/* Flags for new_buffer(). */
+#define BUFFER_SPARSE BIT(0)
+
 // target buffer
 struct buffer {
 	char *data;
 	size_t size;
+	struct sparse_map map; // only the pages that are accessed, if sparse
 };
 
-struct buffer *new_buffer(struct page_format *fmt, void *target);
+int map_sparse_buffer(struct buffer *buffer, struct page_format *fmt,
+	void *target);
+struct buffer *new_buffer(struct page_format *fmt, void *target, int flags);
+size_t prefault_buffer(struct buffer *buffer, struct page_format *fmt);
 void del_buffer(struct buffer *buffer);
@@ -5,20 +5,93 @@
 
 #pragma once
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "macros.h"
+#include "sparse.h"
+
+/* A reduced eviction set: the offsets of the pages in the eviction buffer
+ * that are needed to evict the page tables of a page level. The cache line
+ * to evict is added to each offset.
+ */
+struct evict_set {
+	size_t *offsets;
+	size_t noffsets;
+};
+
+/* The precompiled eviction plan of a page level: the sorted and deduplicated
+ * offsets relative to the cache line to evict, for both the data cache and
+ * the TLBs and page structure caches. The first ndata offsets are relative
+ * to the data eviction buffer, the others to the TLB eviction buffer. The
+ * offsets are stored in units of 1 << shift bytes to keep them compact, or
+ * in full in wide_offsets if they do not fit in 32 bits that way.
+ */
+struct evict_plan {
+	uint32_t *offsets;
+	size_t *wide_offsets;
+	size_t noffsets;
+	size_t ndata;
+	unsigned shift;
+	void **chains; // per cache line, only for EVICT_CHASE
+};
+
+/* Returns the offset in bytes of the given entry of the eviction plan. */
+static inline size_t get_plan_offset(struct evict_plan *plan, size_t i)
+{
+	if (plan->wide_offsets)
+		return plan->wide_offsets[i];
+
+	return (size_t)plan->offsets[i] << plan->shift;
+}
+
+/* The order in which the eviction plan is traversed. */
+enum evict_mode {
+	EVICT_LINEAR,
+	EVICT_REVERSE,
+	EVICT_ZIGZAG,
+	EVICT_CHASE,
+	EVICT_NMODES,
+};
+
+/* Flags for new_cache(). */
+#define CACHE_HUGEPAGES BIT(0)
+#define CACHE_SPARSE BIT(1)
+
+/* Flags in struct cache telling how the data eviction buffer is backed. */
+#define CACHE_HUGETLB BIT(2)
+#define CACHE_THP BIT(3)
 
 struct cache {
 	struct page_format *fmt;
 	char *data; // eviction set
 	size_t size; // eviction set size
+	char *tlb; // TLB eviction set, equal to data if shared
+	size_t tlb_size; // TLB eviction set size
+	struct sparse_map tlb_map; // only the pages that are accessed, if sparse
+	int flags;
 	size_t cache_size;
 	size_t line_size;
+	struct evict_set *evict_sets; // per page level, NULL for a full sweep
+	struct evict_plan *plans; // per page level
+	int evict_mode;
+	int zigzag; // direction of the next EVICT_ZIGZAG traversal
 };
 
 struct cache *new_cache(struct page_format *fmt, void *target,
-	size_t cache_size, size_t line_size);
+	size_t cache_size, size_t line_size, int flags);
 void del_cache(struct cache *cache);
-void evict_cache_line(struct cache *cache, size_t table_size,
-	size_t cache_line, size_t page_level);
+int set_evict_set(struct cache *cache, size_t page_level, size_t *offsets,
+	size_t noffsets);
+void clear_evict_sets(struct cache *cache);
+int map_sparse_tlb(struct cache *cache, void *target);
+int build_evict_plans(struct cache *cache);
+size_t prefault_cache(struct cache *cache);
+int get_evict_mode(const char *name);
+const char *get_evict_mode_name(int mode);
+void list_evict_modes(FILE *f);
+int set_evict_mode(struct cache *cache, int mode);
+void del_evict_plans(struct cache *cache);
+void evict_cache_line(struct cache *cache, size_t cache_line,
+	size_t page_level);
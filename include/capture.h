@@ -0,0 +1,119 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include "macros.h"
+
+#define CAPTURE_MAGIC "ANCCAPTR"
+#define CAPTURE_VERSION 1
+
+/* The number of samples per buffer. */
+#define CAPTURE_NSAMPLES (1 << 20)
+
+/* The sample was a retry of an outlier, or was taken to refine a cell. */
+#define CAPTURE_RETRY BIT(0)
+#define CAPTURE_REFINE BIT(1)
+
+/* The header at the start of a capture file, which is followed by the
+ * samples in the order in which they were taken.
+ */
+struct capture_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t sample_size;
+};
+
+/* A single sample of a round along with where it was taken. */
+struct capture_sample {
+	uint32_t timing;
+	uint32_t page;
+	uint16_t line;
+	uint8_t level;
+	uint8_t flags;
+	uint32_t run;
+};
+
+/* A buffer is either filled by the measuring thread, or full and drained by
+ * the writer thread, which is tracked by the full flag.
+ */
+struct capture_buffer {
+	struct capture_sample *samples;
+	size_t nsamples;
+	atomic_int full;
+};
+
+/* Captures the samples into two preallocated buffers, such that the measuring
+ * thread can fill one buffer while the writer thread drains the other one to
+ * the file. Only the writer thread makes system calls.
+ */
+struct capture {
+	struct capture_buffer buffers[2];
+	struct capture_buffer *active;
+	struct capture_sample context;
+	int armed;
+	atomic_int state;
+	atomic_int stop;
+	FILE *f;
+	pthread_t thread;
+	int cpu;
+	size_t nsamples;
+	size_t nstalls;
+};
+
+extern struct capture *capture;
+
+struct capture *start_capture(const char *path, int cpu);
+int stop_capture(struct capture *capture);
+void swap_capture_buffer(struct capture *capture);
+
+/* Starts capturing the samples of the given run and page level. */
+static inline void arm_capture(size_t run, size_t level, int flags)
+{
+	if (!capture)
+		return;
+
+	capture->context.run = run;
+	capture->context.level = level;
+	capture->context.flags = flags;
+	capture->armed = 1;
+}
+
+static inline void disarm_capture(void)
+{
+	if (capture)
+		capture->armed = 0;
+}
+
+static inline void set_capture_page(size_t page)
+{
+	if (capture)
+		capture->context.page = page;
+}
+
+/* Stores a sample in the active buffer, without making any system calls. */
+static inline void capture_timing(uint64_t timing, size_t line, int flags)
+{
+	struct capture_sample *sample;
+
+	if (!capture || !capture->armed)
+		return;
+
+	if (capture->active->nsamples == CAPTURE_NSAMPLES)
+		swap_capture_buffer(capture);
+
+	sample = capture->active->samples + capture->active->nsamples++;
+	*sample = capture->context;
+	sample->timing = (uint32_t)min(timing, UINT32_MAX);
+	sample->line = line;
+	sample->flags |= flags;
+}
@@ -0,0 +1,20 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+
+/* The normalised timings of a page level before the signals of the other
+ * page levels have been filtered out.
+ */
+struct joint_level {
+	double *timings;
+	size_t ncache_lines;
+	size_t npages;
+	size_t npages_per_line;
+};
+
+double solve_joint(size_t *slots, struct joint_level *levels, size_t nlevels);
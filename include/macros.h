@@ -20,6 +20,11 @@
 #define TIB (1024 * GIB)
 #endif
 
+/* Forces inlining where a call would end up in a timed window, even when
+ * optimising for size.
+ */
+#define always_inline inline __attribute__((always_inline))
+
 /* Used to extract a bit field. */
 #define BIT(n) (1 << (n))
 #define EXTRACT(x, k, n) ((x) >> (k) & ((1 << (n)) - 1))
@@ -18,6 +18,7 @@ struct page_level {
 	size_t ncache_entries;
 	size_t npages;
 	size_t slot_mask;
+	int aggregator;
 };
 
 struct page_format {
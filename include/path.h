@@ -5,4 +5,8 @@
 
 #pragma once
 
+#include <stdlib.h>
+
 int mkpath(const char *path);
+void *map_file(size_t *size, const char *path);
+void unmap_file(void *data, size_t size);
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "macros.h"
@@ -20,18 +21,275 @@
 #error unsupported architecture.
 #endif
 
-int init_profiler(void);
+#include "cache.h"
+#include "timer.h"
+
+struct page_format;
+struct page_level;
+struct solution;
+struct solver_state;
+
+/* The number of ranked solutions to keep per page level. */
+#define NSOLUTIONS 4
+
+/* The cost and eviction success rate of an eviction mode. */
+struct evict_bench {
+	uint64_t cost;
+	uint64_t hit;
+	uint64_t threshold;
+	double success;
+};
+
+/* The cost of an empty measurement using a serialization mode, the spread of
+ * that cost (the interquartile range), and the median latencies of a cache
+ * hit and a page table walk, which tell whether the mode keeps the timed
+ * access within the measurement.
+ */
+struct serialize_bench {
+	uint64_t cost;
+	uint64_t spread;
+	uint64_t hit;
+	uint64_t miss;
+	int valid;
+};
+
+/* The retries of a single round over every page that the profiler uses, taken
+ * before and after the warm-up.
+ */
+struct warm_up_bench {
+	size_t cold;
+	size_t warm;
+};
+
+/* Statistics on the samples taken by the profiler on the calling thread. */
+struct profile_stats {
+	size_t nsamples;
+	size_t nretries;
+	size_t nexhausted;
+	size_t max_retries;
+	size_t nrefined;
+	size_t nskipped;
+};
+
+/* Controls the adaptive mode of profile_page_tables(). While the margin of
+ * the best solution of a page level stays below the confidence, the cells
+ * that separate the best solutions are measured again, until at most the
+ * budget of samples has been spent on the page level. A confidence of zero
+ * disables the adaptive mode. With a non-zero error rate, profiling a page
+ * level stops as soon as the best solution is significant at that rate.
+ */
+struct profile_policy {
+	double confidence;
+	size_t budget;
+	double error_rate;
+};
+
+/* The latencies of a cache hit and of a page table walk that misses the
+ * caches, the bound above which a sample is considered an outlier and
+ * retaken, and the number of times a sample may be retaken. The baseline is
+ * the cost of an empty measurement in ticks of the timer, which is
+ * subtracted from every sample.
+ */
+struct profile_model {
+	uint64_t baseline;
+	uint64_t hit;
+	uint64_t miss;
+	uint64_t bound;
+	size_t max_retries;
+	double outliers;
+};
+
+extern _Thread_local struct profile_stats profile_stats;
+extern struct profile_model profile_model;
+
+/* Reads the given kind of timer. As the kind is a constant wherever this is
+ * inlined, the timers that can be read inline are read without any branch or
+ * call.
+ */
+static always_inline uint64_t read_timer_kind(int kind)
+{
+	switch (kind) {
+#if defined(__x86_64__)
+	case TIMER_RDTSCP:
+		return rdtscp();
+	case TIMER_RDTSC:
+		return rdtsc_lfence();
+#elif defined(__aarch64__)
+	case TIMER_CNTVCT:
+		return cntvct();
+#endif
+	default:
+		return read_timer();
+	}
+}
+
+/* Takes a timestamp before and after touching the given address, or nothing
+ * if p is NULL, using the given kind of timer, and returns the difference in
+ * ticks of the timer.
+ */
+static always_inline uint64_t time_access_kind(volatile char *p,
+	int kind)
+{
+	uint64_t past, now;
+
+	data_barrier();
+	code_barrier();
+	past = read_timer_kind(kind);
+	data_barrier();
+
+	if (p)
+		*p = 0x5A;
+
+	data_barrier();
+	now = read_timer_kind(kind);
+	code_barrier();
+	data_barrier();
+
+	return now - past;
+}
+
+/* Takes a timestamp before and after touching the given address, or nothing
+ * if p is NULL, and returns the difference in ticks of the timer. The timer
+ * is picked before the measurement starts.
+ */
+static inline uint64_t time_access(volatile char *p)
+{
+	switch (timer_kind) {
+	case TIMER_RDTSCP:
+		return time_access_kind(p, TIMER_RDTSCP);
+	case TIMER_RDTSC:
+		return time_access_kind(p, TIMER_RDTSC);
+	case TIMER_CNTVCT:
+		return time_access_kind(p, TIMER_CNTVCT);
+	default:
+		return time_access_kind(p, TIMER_CALL);
+	}
+}
+
+/* Subtracts the cost of an empty measurement and converts the result into the
+ * unit that timings are reported in.
+ */
+static inline uint64_t correct_timing(uint64_t ticks)
+{
+	ticks = ticks > profile_model.baseline ? ticks - profile_model.baseline : 0;
+
+	return scale_ticks(ticks);
+}
+
+/* Evicts the given cache line and times the access to p for every round
+ * using the given kind of timer.
+ */
+static always_inline void profile_rounds_kind(
+	uint64_t *timings, struct cache *cache, size_t cache_line,
+	size_t page_level, size_t nrounds, volatile char *p, int kind)
+{
+	size_t i;
+
+	for (i = 0; i < nrounds; ++i) {
+		evict_cache_line(cache, cache_line, page_level);
+		timings[i] = time_access_kind(p, kind);
+	}
+}
+
+/* Evicts the given cache line and times the access to p for every round,
+ * recording the corrected timings into the preallocated array. The timer is
+ * picked once for all rounds, such that each kind of timer gets a kernel of
+ * its own.
+ */
+static inline void profile_rounds(uint64_t *timings, struct cache *cache,
+	size_t cache_line, size_t page_level, size_t nrounds,
+	volatile char *p)
+{
+	size_t i;
+
+	switch (timer_kind) {
+	case TIMER_RDTSCP:
+		profile_rounds_kind(timings, cache, cache_line, page_level,
+			nrounds, p, TIMER_RDTSCP);
+		break;
+	case TIMER_RDTSC:
+		profile_rounds_kind(timings, cache, cache_line, page_level,
+			nrounds, p, TIMER_RDTSC);
+		break;
+	case TIMER_CNTVCT:
+		profile_rounds_kind(timings, cache, cache_line, page_level,
+			nrounds, p, TIMER_CNTVCT);
+		break;
+	default:
+		profile_rounds_kind(timings, cache, cache_line, page_level,
+			nrounds, p, TIMER_CALL);
+		break;
+	}
+
+	for (i = 0; i < nrounds; ++i)
+		timings[i] = correct_timing(timings[i]);
+}
+
+int init_profiler(int timer);
 uint64_t profile_access(volatile char *p);
+int get_serialize_mode(const char *name);
+const char *get_serialize_mode_name(int mode);
+void list_serialize_modes(FILE *f);
+int set_serialize_mode(int mode);
+int bench_serialize_modes(
+	struct serialize_bench *results,
+	struct cache *cache,
+	size_t nsamples,
+	volatile char *target);
+int calibrate_profiler(
+	struct cache *cache,
+	size_t nsamples,
+	volatile char *target);
 
-void profile_page_table(
+size_t profile_page_table(
 	uint64_t *timings,
+	uint32_t *samples,
 	struct cache *cache,
 	struct page_level *level,
 	size_t n,
 	size_t ncache_lines,
 	size_t nrounds,
 	volatile char *target,
+	size_t stride,
+	struct solver_state *state);
+void warm_up_profiler(
+	struct warm_up_bench *bench,
+	struct cache *cache,
+	struct page_format *fmt,
+	size_t nrounds,
+	volatile char *target);
+int find_evict_set(
+	struct cache *cache,
+	struct page_level *level,
+	size_t n,
+	size_t nrounds,
+	volatile char *target);
+double probe_page_table(
+	struct cache *cache,
+	struct page_level *level,
+	size_t n,
+	size_t ncontrol_lines,
+	size_t nrounds,
+	volatile char *target,
 	size_t stride);
+int bench_evict_modes(
+	struct evict_bench *results,
+	struct cache *cache,
+	size_t n,
+	size_t nsamples,
+	volatile char *target);
+uint64_t *load_timings(
+	size_t *npages,
+	const char *name,
+	size_t n,
+	size_t ncache_lines,
+	size_t run,
+	const char *input_dir);
+int load_reference(
+	size_t *slots,
+	struct page_format *fmt,
+	size_t run,
+	const char *input_dir);
 void filter_signals(
 	uint64_t *timings,
 	struct page_format *fmt,
@@ -40,10 +298,25 @@ void filter_signals(
 	size_t ncache_lines,
 	size_t npages_per_line,
 	size_t nlevel);
+size_t rank_page_table(
+	struct solution *solutions,
+	uint64_t *filtered,
+	double *ntimings,
+	uint64_t *timings,
+	struct page_format *fmt,
+	struct page_level *level,
+	volatile void *target,
+	size_t n,
+	size_t ncache_lines,
+	size_t npages_per_line);
 unsigned profile_page_tables(
 	unsigned *slot_error_distances,
+	double *margins,
+	int *joint_slot_errors,
+	double *joint_probability,
 	struct cache *cache,
 	struct page_format *fmt,
+	struct profile_policy *policy,
 	size_t nrounds,
 	volatile void *target,
 	size_t run,
@@ -0,0 +1,94 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "macros.h"
+
+#define RECORD_MAGIC "ANCTIMES"
+#define RECORD_VERSION 1
+#define RECORD_MAX_LEVELS 4
+
+/* The arrays in a record start at multiples of this alignment. */
+#define RECORD_ALIGN 64
+
+/* The formats to save the timings of a run in. */
+#define RECORD_TEXT BIT(0)
+#define RECORD_BINARY BIT(1)
+
+/* The timings of the record are in nanoseconds rather than ticks. */
+#define RECORD_NS BIT(0)
+
+/* The geometry of a page level in a record, the slot of the target and the
+ * file offsets of the aggregated timings, indexed by page and then by cache
+ * line, and of the samples of every round, indexed by page, cache line and
+ * round. Both are arrays of native 32-bit integers. The samples are optional
+ * and have an offset of zero if they are missing.
+ */
+struct record_level {
+	uint64_t page_size;
+	uint32_t entry_size;
+	uint32_t nentries;
+	uint32_t ncache_lines;
+	uint32_t npages;
+	uint32_t npages_per_line;
+	uint32_t expected_slot;
+	uint64_t timings;
+	uint64_t samples;
+};
+
+/* The fixed header at the start of a record, which is followed by the arrays
+ * of every page level. Strings are NUL-padded.
+ */
+struct record_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t nlevels;
+	uint32_t nrounds;
+	uint32_t line_size;
+	uint32_t flags;
+	char page_format[32];
+	char timer[32];
+	char cpu[64];
+	struct record_level levels[RECORD_MAX_LEVELS];
+};
+
+/* The setup to store in every record, as well as the formats to save the
+ * timings in.
+ */
+struct record_config {
+	int formats;
+	int flags;
+	const char *timer;
+	const char *cpu;
+};
+
+/* A record that is being written. */
+struct record_writer {
+	struct record_header header;
+	FILE *f;
+};
+
+/* A record mapped into memory. */
+struct record {
+	struct record_header *header;
+	size_t size;
+};
+
+extern struct record_config record_config;
+
+int open_record_writer(struct record_writer *writer, const char *path,
+	const char *page_format, size_t nrounds, size_t line_size);
+int write_record_level(struct record_writer *writer, size_t n,
+	struct record_level *level, uint64_t *timings, uint32_t *samples);
+int close_record_writer(struct record_writer *writer);
+struct record *map_record(const char *path);
+void unmap_record(struct record *record);
+uint64_t *load_record_timings(struct record *record, size_t n);
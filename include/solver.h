@@ -6,13 +6,63 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 
 #include "macros.h"
 
+/* How the timings of a page level are turned into the scores that the solver
+ * sums along the diagonals: the min-max normalised timings, or the
+ * log-likelihood ratio of a cache miss over a cache hit.
+ */
+enum score_mode {
+	SCORE_SUM,
+	SCORE_LIKELIHOOD,
+	SCORE_NMODES,
+};
+
+/* A candidate cache line and page offset with its score. */
+struct solution {
+	size_t line;
+	size_t page;
+	double score;
+};
+
+/* The scores of every candidate over the rows of timings seen so far. */
+struct solver_state {
+	double *sums;
+	size_t ncache_lines;
+	size_t npages_per_line;
+	size_t nrows;
+	double error_rate;
+};
+
+int get_score_mode(const char *name);
+const char *get_score_mode_name(int mode);
+void list_score_modes(FILE *f);
+void set_score_mode(int mode);
+int get_current_score_mode(void);
+const char *get_joint_measure(void);
+const char *get_margin_unit(void);
 void normalise_timings(double *ntimings, uint64_t *timings,
 	size_t ncache_lines, size_t npages);
+void score_timings(double *scores, uint64_t *timings,
+	size_t ncache_lines, size_t npages);
 double solve_line(double *timings, size_t line, size_t page,
 	size_t ncache_lines, size_t npages, size_t npages_per_line);
+void set_solver_threads(size_t nthreads);
 void solve_lines(size_t *best_line, size_t *best_page,
 	double *timings, size_t ncache_lines, size_t npages,
 	size_t npages_per_line);
+size_t rank_lines(struct solution *solutions, size_t nsolutions,
+	double *timings, size_t ncache_lines, size_t npages,
+	size_t npages_per_line);
+double get_margin(struct solution *solutions, size_t nsolutions,
+	size_t npages);
+struct solver_state *new_solver_state(size_t ncache_lines,
+	size_t npages_per_line, double error_rate);
+void del_solver_state(struct solver_state *state);
+void reset_solver_state(struct solver_state *state);
+void update_solver_state(struct solver_state *state, double *timings);
+size_t rank_solver_state(struct solution *solutions, size_t nsolutions,
+	struct solver_state *state);
+int is_solver_done(struct solver_state *state);
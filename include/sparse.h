@@ -0,0 +1,27 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* A buffer of which only the pages that are actually accessed are mapped,
+ * each at a fixed offset from the base address.
+ */
+struct sparse_map {
+	char *base;
+	size_t *ranges; // pairs of start and end offsets
+	size_t nranges;
+};
+
+int map_sparse(struct sparse_map *map, void *target, size_t *offsets,
+	size_t noffsets, size_t length);
+void unmap_sparse(struct sparse_map *map);
+
+size_t get_map_granularity(void);
+uintptr_t get_va_limit(void);
+int map_fixed(void *addr, size_t len);
+void unmap_fixed(void *addr, size_t len);
@@ -5,5 +5,10 @@
 
 #pragma once
 
+#include <stdlib.h>
+
 int check_transparent_hugepages(void);
+size_t get_core_cpu(size_t cpu);
+size_t *get_online_cpus(size_t *ncpus);
+int pick_other_core_cpu(const int *excluded, size_t nexcluded);
 
@@ -5,4 +5,7 @@
 
 #pragma once
 
+#include <stdlib.h>
+
 int pin_cpu(size_t i);
+size_t get_cpu_count(void);
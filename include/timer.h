@@ -0,0 +1,78 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* The timers that the profiler reads inline, such that the timed window does
+ * not contain an indirect call. Any other timer is read through read_timer.
+ */
+enum timer_kind {
+	TIMER_CALL,
+	TIMER_RDTSCP,
+	TIMER_RDTSC,
+	TIMER_CNTVCT,
+};
+
+/* A source of timestamps. The unit of the timestamps depends on the timer,
+ * e.g. cycles, ticks of the system counter or nanoseconds.
+ */
+struct timer {
+	const char *name;
+	int (*init)(void);
+	void (*fini)(void);
+	uint64_t (*read)(void);
+	int kind;
+};
+
+/* The smallest non-zero difference between two successive timestamps and the
+ * median difference, i.e. the cost of taking a timestamp, both in the unit of
+ * the timer, as well as the rate of the timer against the monotonic clock of
+ * the system and the relative spread of that rate.
+ */
+struct timer_calib {
+	uint64_t resolution;
+	uint64_t overhead;
+	double ticks_per_ns;
+	double jitter;
+};
+
+/* The number of fractional bits of timer_scale. */
+#define TIMER_SCALE_SHIFT 16
+
+extern struct timer rdtscp_timer;
+extern struct timer rdtsc_timer;
+extern struct timer cntvct_timer;
+extern struct timer perf_timer;
+extern struct timer monotonic_timer;
+extern struct timer thread_timer;
+
+extern uint64_t (*read_timer)(void);
+extern int timer_kind;
+extern uint64_t timer_scale;
+
+/* Converts a difference between timestamps into nanoseconds if requested
+ * using set_timer_ns().
+ */
+static inline uint64_t scale_ticks(uint64_t ticks)
+{
+	if (!timer_scale)
+		return ticks;
+
+	return (ticks * timer_scale) >> TIMER_SCALE_SHIFT;
+}
+
+int get_timer(const char *name);
+const char *get_timer_name(int timer);
+void list_timers(FILE *f);
+int pick_timer_cpu(size_t cpu);
+void set_timer_cpu(int cpu);
+int init_timer(int timer);
+void fini_timer(void);
+int calibrate_timer(struct timer_calib *calib, size_t nsamples);
+int set_timer_ns(struct timer_calib *calib);
@@ -8,39 +8,75 @@
 #include <stdint.h>
 
 #include "config.h"
+#include "macros.h"
 
-typedef uint64_t cycles_t;
+/* The ways to keep instructions from being executed out of order around the
+ * timed access, see serialize_modes.
+ */
+enum serialize_mode {
+	SERIALIZE_CPUID,
+	SERIALIZE_LFENCE,
+	SERIALIZE_RDTSCP,
+	SERIALIZE_MFENCE,
+	SERIALIZE_NMODES,
+};
 
-extern volatile cycles_t timer_cycles;
+extern const char *serialize_modes[];
+extern int serialize_mode;
 
-static inline void code_barrier(void)
+static always_inline void code_barrier(void)
 {
-	asm volatile("cpuid\n" :: "a" (0) : "%rbx", "%rcx", "%rdx");
+	switch (serialize_mode) {
+	case SERIALIZE_LFENCE:
+		asm volatile("lfence\n" ::: "memory");
+		break;
+	case SERIALIZE_RDTSCP:
+		asm volatile("rdtscp\nlfence\n" ::: "%rax", "%rcx", "%rdx",
+			"memory");
+		break;
+	case SERIALIZE_MFENCE:
+		asm volatile("mfence\nlfence\n" ::: "memory");
+		break;
+	default:
+		asm volatile("cpuid\n" :: "a" (0) : "%rbx", "%rcx", "%rdx",
+			"memory");
+		break;
+	}
 }
 
-static inline void data_barrier(void)
+static always_inline void data_barrier(void)
 {
 	asm volatile("mfence\n" ::: "memory");
 }
 
-static inline cycles_t rdtsc(void)
+static always_inline uint64_t rdtscp(void)
 {
-#if CONFIG_USE_RDTSCP
-	cycles_t cycles_lo, cycles_hi;
-	
+	uint64_t cycles_lo, cycles_hi;
+
 	asm volatile("rdtscp\n" :
 		"=a" (cycles_lo), "=d" (cycles_hi) ::
 		"%rcx");
 
-	return ((uint64_t)cycles_hi << 32) | cycles_lo;
-#elif CONFIG_USE_RDTSC
-	cycles_t cycles_lo, cycles_hi;
+	return (cycles_hi << 32) | cycles_lo;
+}
+
+static always_inline uint64_t rdtsc_lfence(void)
+{
+	uint64_t cycles_lo, cycles_hi;
 
-	asm volatile("rdtsc\n" :
+	asm volatile("lfence\nrdtsc\n" :
 		"=a" (cycles_lo), "=d" (cycles_hi));
-	return ((uint64_t)cycles_hi << 32) | cycles_lo;
-#else
-	return timer_cycles;
-#endif
+
+	return (cycles_hi << 32) | cycles_lo;
 }
 
+static inline uint64_t rdpmc(uint32_t counter)
+{
+	uint64_t count_lo, count_hi;
+
+	asm volatile("rdpmc\n" :
+		"=a" (count_lo), "=d" (count_hi) :
+		"c" (counter));
+
+	return (count_hi << 32) | count_lo;
+}
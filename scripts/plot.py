@@ -22,23 +22,83 @@ def get_cpu_name():
 
     return 'unknown CPU'
 
-def plot_levels(input, attempt, output, cpu_name):
-    page_table_size = 1024 * 4
-    ncache_lines = page_table_size / 64
+# The layout of struct record_level and struct record_header in
+# include/record.h.
+record_level_dtype = np.dtype([
+    ('page_size', '<u8'),
+    ('entry_size', '<u4'),
+    ('nentries', '<u4'),
+    ('ncache_lines', '<u4'),
+    ('npages', '<u4'),
+    ('npages_per_line', '<u4'),
+    ('expected_slot', '<u4'),
+    ('timings', '<u8'),
+    ('samples', '<u8'),
+])
+
+record_header_dtype = np.dtype([
+    ('magic', 'S8'),
+    ('version', '<u4'),
+    ('header_size', '<u4'),
+    ('nlevels', '<u4'),
+    ('nrounds', '<u4'),
+    ('line_size', '<u4'),
+    ('flags', '<u4'),
+    ('page_format', 'S32'),
+    ('timer', 'S32'),
+    ('cpu', 'S64'),
+    ('levels', record_level_dtype, (4,)),
+])
+
+def load_record(path):
+    header = np.memmap(path, dtype=record_header_dtype, mode='r', shape=(1,))[0]
+
+    if header['magic'] != b'ANCTIMES' or header['version'] != 1:
+        raise ValueError('{} is not a supported record'.format(path))
+
+    levels = []
+    expected = []
+
+    for level in header['levels'][:header['nlevels']]:
+        shape = (int(level['npages']), int(level['ncache_lines']))
+        levels.append(np.memmap(path, dtype='<u4', mode='r',
+            offset=int(level['timings']), shape=shape))
+        npages_per_line = int(level['npages_per_line'])
+        slot = int(level['expected_slot'])
+        expected.append([npages_per_line, slot // npages_per_line,
+            slot % npages_per_line])
+
+    return header, levels, np.array(expected)
 
-    expected = np.loadtxt(os.path.join(input, '{}-reference.csv'.format(attempt)))
+def plot_levels(input, attempt, output, cpu_name):
+    record_path = os.path.join(input, '{}-timings.bin'.format(attempt))
     solutions = np.loadtxt(os.path.join(input, '{}-solutions.csv'.format(attempt)))
 
+    level_path = os.path.join(input, '{}-level{{}}.csv'.format(attempt))
+
+    # The level files hold the filtered timings that the solver used, while
+    # the binary record holds the timings before filtering, so only fall
+    # back to the latter without the former.
+    if os.path.exists(level_path.format(1)) or not os.path.exists(record_path):
+        expected = np.loadtxt(os.path.join(input, '{}-reference.csv'.format(attempt)))
+        levels = [np.loadtxt(level_path.format(i))
+            for i in range(1, len(expected) + 1)]
+    else:
+        header, levels, expected = load_record(record_path)
+        cpu_name = cpu_name or header['cpu'].decode() or None
+
+    cpu_name = cpu_name or get_cpu_name()
+
     with PdfPages(output) as pdf:
         for i in range(1, len(expected) + 1):
             plt.figure()
-            data = np.loadtxt(os.path.join(input, '{}-level{}.csv'.format(attempt, i)))
+            data = np.asarray(levels[i - 1], dtype=float)
             data = np.array([(row - np.min(row)) / ((np.max(row) - np.min(row) or np.max(row))) for row in data])
             #data = data > 0.1
 
             plt.pcolormesh(data, cmap=plt.cm.Blues, vmin=0, vmax=1)
 
-            [npages_per_line, line, page] = expected[i - 1]
+            [npages_per_line, line, page] = expected[i - 1][:3]
 
             ys = np.arange(0, data.shape[0] + npages_per_line, npages_per_line) - page
             xs = (line + (ys + page) // npages_per_line) % data.shape[1]
@@ -48,7 +108,9 @@ def plot_levels(input, attempt, output, cpu_name):
                     edgecolor='lime', facecolor='none', hatch='/' * 8)
                 plt.gca().add_patch(rect)
 
-            [npages_per_line, line, page] = solutions[i - 1]
+            # The solutions may carry a confidence margin after the
+            # first three columns.
+            [npages_per_line, line, page] = solutions[i - 1][:3]
 
             ys = np.arange(0, data.shape[0] + npages_per_line, npages_per_line) - page
             xs = (line + (ys + page) // npages_per_line) % data.shape[1]
@@ -78,8 +140,7 @@ def main():
         default=0)
     args = parser.parse_args()
 
-    plot_levels(args.input, args.attempt, args.output,
-        args.cpu_name or get_cpu_name())
+    plot_levels(args.input, args.attempt, args.output, args.cpu_name)
 
 if __name__ == '__main__':
     main()
@@ -0,0 +1,305 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aggregate.h"
+#include "macros.h"
+
+/* Up to this number of samples, sorting networks are used instead of
+ * selection.
+ */
+#define MAX_NETWORK_SIZE 32
+
+/* The number of samples of which the remedian takes the median at a time,
+ * and the number of levels of such buffers, which bounds the number of
+ * samples it can process to REMEDIAN_BASE ^ REMEDIAN_NLEVELS.
+ */
+#define REMEDIAN_BASE 9
+#define REMEDIAN_NLEVELS 8
+
+static const char *aggregators[] = {
+	[AGGREGATE_MEDIAN] = "median",
+	[AGGREGATE_REMEDIAN] = "remedian",
+	[AGGREGATE_TRIMMED_MEAN] = "trimmed-mean",
+	[AGGREGATE_MIN] = "min",
+	[AGGREGATE_MODE] = "mode",
+};
+
+int get_aggregator(const char *name)
+{
+	int aggregator;
+
+	for (aggregator = 0; aggregator < AGGREGATE_NMODES; ++aggregator) {
+		if (strcmp(aggregators[aggregator], name) == 0)
+			return aggregator;
+	}
+
+	return -1;
+}
+
+const char *get_aggregator_name(int aggregator)
+{
+	if (aggregator < 0 || aggregator >= AGGREGATE_NMODES)
+		return NULL;
+
+	return aggregators[aggregator];
+}
+
+void list_aggregators(FILE *f)
+{
+	int aggregator;
+
+	for (aggregator = 0; aggregator < AGGREGATE_NMODES; ++aggregator)
+		fprintf(f, "%s ", aggregators[aggregator]);
+}
+
+static inline void swap_samples(uint64_t *lhs, uint64_t *rhs)
+{
+	uint64_t tmp = *lhs;
+
+	*lhs = *rhs;
+	*rhs = tmp;
+}
+
+static inline void cmp_swap(uint64_t *lhs, uint64_t *rhs)
+{
+	uint64_t lo = min(*lhs, *rhs);
+	uint64_t hi = max(*lhs, *rhs);
+
+	*lhs = lo;
+	*rhs = hi;
+}
+
+/* Batcher's odd-even merge sort for an arbitrary number of samples. The
+ * compare-exchange sequence does not depend on the data, so it runs without
+ * mispredicted branches.
+ */
+static void sort_network(uint64_t *samples, size_t n)
+{
+	size_t p, k, j, i;
+
+	for (p = 1; p < n; p <<= 1) {
+		for (k = p; k >= 1; k >>= 1) {
+			for (j = k % p; j + k < n; j += 2 * k) {
+				for (i = 0; i < min(k, n - j - k); ++i) {
+					if ((i + j) / (2 * p) != (i + j + k) / (2 * p))
+						continue;
+
+					cmp_swap(samples + i + j, samples + i + j + k);
+				}
+			}
+		}
+	}
+}
+
+static int cmp_uint64(const void *lhs_, const void *rhs_)
+{
+	const uint64_t *lhs = lhs_, *rhs = rhs_;
+
+	if (*lhs < *rhs)
+		return -1;
+
+	if (*lhs > *rhs)
+		return 1;
+
+	return 0;
+}
+
+void sort_samples(uint64_t *samples, size_t n)
+{
+	if (n <= MAX_NETWORK_SIZE)
+		sort_network(samples, n);
+	else
+		qsort(samples, n, sizeof *samples, cmp_uint64);
+}
+
+/* Moves the k-th smallest sample to index k, with the smaller samples before
+ * and the larger samples after it, and returns it. Uses quickselect with the
+ * median of three as the pivot, and a sorting network for small ranges.
+ */
+uint64_t select_sample(uint64_t *samples, size_t n, size_t k)
+{
+	uint64_t *lo = samples, *hi = samples + n - 1;
+	uint64_t *mid, *p, *q;
+	uint64_t pivot;
+
+	while ((size_t)(hi - lo) >= MAX_NETWORK_SIZE) {
+		mid = lo + (hi - lo) / 2;
+		cmp_swap(lo, mid);
+		cmp_swap(mid, hi);
+		cmp_swap(lo, mid);
+		pivot = *mid;
+
+		for (p = lo, q = hi;;) {
+			while (*p < pivot)
+				++p;
+
+			while (*q > pivot)
+				--q;
+
+			if (p >= q)
+				break;
+
+			swap_samples(p++, q--);
+		}
+
+		if (samples + k <= q)
+			hi = q;
+		else
+			lo = q + 1;
+	}
+
+	sort_network(lo, hi - lo + 1);
+
+	return samples[k];
+}
+
+/* Approximates the median in a single pass with bounded memory, by taking
+ * the median of every REMEDIAN_BASE samples and passing it on to the next
+ * level. The leftover buffers are combined using a weighted median.
+ */
+static uint64_t remedian(const uint64_t *samples, size_t n)
+{
+	uint64_t buffers[REMEDIAN_NLEVELS][REMEDIAN_BASE];
+	size_t counts[REMEDIAN_NLEVELS] = { 0 };
+	uint64_t value = 0, best;
+	size_t weight, total = 0, seen;
+	size_t i, j, level;
+
+	for (i = 0; i < n; ++i) {
+		value = samples[i];
+
+		for (level = 0; level < REMEDIAN_NLEVELS; ++level) {
+			buffers[level][counts[level]++] = value;
+
+			if (counts[level] < REMEDIAN_BASE ||
+				level + 1 == REMEDIAN_NLEVELS)
+				break;
+
+			sort_network(buffers[level], REMEDIAN_BASE);
+			value = buffers[level][REMEDIAN_BASE / 2];
+			counts[level] = 0;
+		}
+
+		if (level == REMEDIAN_NLEVELS - 1 &&
+			counts[level] == REMEDIAN_BASE)
+			counts[level] = REMEDIAN_BASE - 1;
+	}
+
+	for (level = 0, weight = 1; level < REMEDIAN_NLEVELS; ++level) {
+		total += counts[level] * weight;
+		sort_network(buffers[level], counts[level]);
+		weight *= REMEDIAN_BASE;
+	}
+
+	/* Walk through the leftover samples in ascending order until half of
+	 * the total weight has been seen.
+	 */
+	for (seen = 0; seen <= total / 2;) {
+		best = UINT64_MAX;
+		j = REMEDIAN_NLEVELS;
+
+		for (level = 0; level < REMEDIAN_NLEVELS; ++level) {
+			if (counts[level] && buffers[level][0] < best) {
+				best = buffers[level][0];
+				j = level;
+			}
+		}
+
+		if (j == REMEDIAN_NLEVELS)
+			break;
+
+		for (level = 0, weight = 1; level < j; ++level)
+			weight *= REMEDIAN_BASE;
+
+		value = best;
+		seen += weight;
+		memmove(buffers[j], buffers[j] + 1,
+			--counts[j] * sizeof *buffers[j]);
+	}
+
+	return value;
+}
+
+/* Takes the mean of the middle half of the samples. */
+static uint64_t trimmed_mean(uint64_t *samples, size_t n)
+{
+	size_t lo = n / 4, hi = n - n / 4;
+	uint64_t sum = 0;
+	size_t i;
+
+	select_sample(samples, n, lo);
+	select_sample(samples + lo, n - lo, hi - lo - 1);
+
+	for (i = lo; i < hi; ++i)
+		sum += samples[i];
+
+	return sum / (hi - lo);
+}
+
+static uint64_t minimum(const uint64_t *samples, size_t n)
+{
+	uint64_t value = UINT64_MAX;
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		value = min(value, samples[i]);
+
+	return value;
+}
+
+/* Finds the densest window of the samples, with the width of a bin as given
+ * by the Freedman-Diaconis rule, and returns the median of the samples in
+ * that window. The first window wins on ties.
+ */
+static uint64_t mode(uint64_t *samples, size_t n)
+{
+	uint64_t width, iqr;
+	size_t i, j = 0, best = 0, count = 0;
+	size_t cbrt_n;
+
+	sort_samples(samples, n);
+
+	for (cbrt_n = 1; (cbrt_n + 1) * (cbrt_n + 1) * (cbrt_n + 1) <= n;)
+		++cbrt_n;
+
+	iqr = samples[3 * n / 4] - samples[n / 4];
+	width = max(2 * iqr / cbrt_n, 1);
+
+	for (i = 0; i < n; ++i) {
+		while (samples[i] - samples[j] >= width)
+			++j;
+
+		if (i - j + 1 > count) {
+			count = i - j + 1;
+			best = j;
+		}
+	}
+
+	return samples[best + count / 2];
+}
+
+/* Reduces the given samples to a single timing using the given estimator.
+ * The samples may be reordered.
+ */
+uint64_t aggregate(uint64_t *samples, size_t n, int aggregator)
+{
+	if (!n)
+		return 0;
+
+	switch (aggregator) {
+	case AGGREGATE_REMEDIAN: return remedian(samples, n);
+	case AGGREGATE_TRIMMED_MEAN: return trimmed_mean(samples, n);
+	case AGGREGATE_MIN: return minimum(samples, n);
+	case AGGREGATE_MODE: return mode(samples, n);
+	default: break;
+	}
+
+	return select_sample(samples, n, n / 2);
+}
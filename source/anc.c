@@ -13,11 +13,15 @@
 #include "args.h"
 #include "buffer.h"
 #include "cache.h"
+#include "capture.h"
 #include "paging.h"
 #include "profile.h"
+#include "record.h"
 #include "shuffle.h"
+#include "solver.h"
 #include "sysfs.h"
 #include "thread.h"
+#include "timer.h"
 #include "macros.h"
 #include "path.h"
 
@@ -26,6 +30,21 @@
 #include <cpuid/cpuid.h>
 #endif
 
+/* Picks a CPU for the writer thread of the capture on a physical core other
+ * than the one that measures and, if possible, the one that the counting
+ * thread of the timer uses.
+ */
+static int pick_capture_cpu(size_t cpu, int timer_cpu)
+{
+	int excluded[] = { (int)cpu, timer_cpu };
+	int ret;
+
+	if ((ret = pick_other_core_cpu(excluded, 2)) < 0)
+		ret = pick_other_core_cpu(excluded, 1);
+
+	return ret;
+}
+
 int main(int argc, const char *argv[])
 {
 	struct args args = {
@@ -34,17 +53,29 @@ int main(int argc, const char *argv[])
 		.nrounds = 10,
 		.line_size = 64,
 		.nruns = 1,
-		.output = "results"
+		.output = "results",
+		.timer_cpu = -1,
+		.capture_cpu = -1,
+		.serialize = -1,
 	};
 	struct buffer *buffer;
 	struct cache *cache;
 	struct page_format *page_format;
+	struct timer_calib timer_calib;
+	struct profile_policy policy;
 	size_t run;
 	size_t i;
 	unsigned num_errors = 0;
 	unsigned total_slot_errors = 0;
 	unsigned total_slot_error_distances = 0;
 	unsigned slot_errors;
+	double total_margins[4] = { 0 };
+	double total_probability = 0;
+	double joint_probability;
+	size_t njoint = 0;
+	unsigned joint_errors = 0;
+	int joint_slot_errors;
+	double min_margins[4] = { 0 };
 	int ret = -1;
 
 	if (check_transparent_hugepages()) {
@@ -60,6 +91,8 @@ int main(int argc, const char *argv[])
 	}
 
 	detect_args(&args);
+	set_solver_threads(args.nsolver_threads);
+	set_score_mode(args.score);
 
 	if (!args.line_size) {
 		dprintf("unable to detect line size, please specify the cache "
@@ -88,7 +121,12 @@ int main(int argc, const char *argv[])
 
 	print_args(stdout, &args, page_format);
 
-	if (init_profiler() < 0) {
+	if (args.timer_cpu < 0)
+		args.timer_cpu = pick_timer_cpu(args.cpu);
+
+	set_timer_cpu(args.timer_cpu);
+
+	if (init_profiler(args.timer) < 0) {
 		dprintf("unable to set up the profiler.\n");
 		return -1;
 	}
@@ -98,29 +136,190 @@ int main(int argc, const char *argv[])
 		return -1;
 	}
 
-	if (!(buffer = new_buffer(page_format, (void *)args.target))) {
+	if (!(buffer = new_buffer(page_format, (void *)args.target,
+		args.sparse ? BUFFER_SPARSE : 0))) {
 		dprintf("unable to allocate the target buffer.\n");
 		return -1;
 	}
 
-	if (!(cache = new_cache(page_format, NULL, args.cache_size, args.line_size))) {
+	if (!(cache = new_cache(page_format, NULL, args.cache_size, args.line_size,
+		(args.evict_hugepages ? CACHE_HUGEPAGES : 0) |
+		(args.sparse ? CACHE_SPARSE : 0)))) {
 		dprintf("unable to allocate the eviction set.\n");
 		goto err_del_buffer;
 	}
 
+	if (args.evict_hugepages && !(cache->flags & (CACHE_HUGETLB | CACHE_THP)))
+		printf("Huge pages are not available for the eviction set.\n");
+
+	if (calibrate_timer(&timer_calib, 1000) < 0) {
+		dprintf("unable to calibrate the timer.\n");
+		goto err_del_cache;
+	}
+
+	printf("Timer: %s (resolution %" PRIu64 ", overhead %" PRIu64
+		", %lf ticks/ns, %lf%% jitter)\n", get_timer_name(args.timer),
+		timer_calib.resolution, timer_calib.overhead,
+		timer_calib.ticks_per_ns, 100.0 * timer_calib.jitter);
+
+	if (args.timer_ns && set_timer_ns(&timer_calib) < 0) {
+		dprintf("unable to report timings in nanoseconds.\n");
+		goto err_del_cache;
+	}
+
 #if defined(__i386__) || defined(__x86_64__)
 	printf("Detected CPU name: %s\n\n", cpuid_get_cpu_name());
+	record_config.cpu = cpuid_get_cpu_name();
 #endif
 
+	if (args.record_formats)
+		record_config.formats = args.record_formats;
+
+	record_config.flags = args.timer_ns ? RECORD_NS : 0;
+	record_config.timer = get_timer_name(args.timer);
+
 	srand(time(0));
 
 	printf("Target VA: %p\n", buffer->data);
+	printf("Prefaulted: %zu target and %zu eviction page accesses\n",
+		prefault_buffer(buffer, page_format), prefault_cache(cache));
+
+	if (args.serialize < 0) {
+		struct serialize_bench results[SERIALIZE_NMODES];
+		int mode;
+
+		printf("\n ---- SERIALIZATION ----\n");
+		printf("mode\t\tcost\tspread\thit\tmiss\tvalid\n");
+
+		if ((args.serialize = bench_serialize_modes(results, cache,
+			10 * args.nrounds, buffer->data)) < 0) {
+			dprintf("unable to benchmark the serialization modes.\n");
+			goto err_del_cache;
+		}
+
+		for (mode = 0; mode < SERIALIZE_NMODES; ++mode) {
+			printf("%-15s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\t%"
+				PRIu64 "\t%s\n", get_serialize_mode_name(mode),
+				results[mode].cost, results[mode].spread,
+				results[mode].hit, results[mode].miss,
+				results[mode].valid ? "yes" : "no");
+		}
+
+		printf("\n");
+	}
+
+	set_serialize_mode(args.serialize);
+	printf("Serialization: %s\n", get_serialize_mode_name(args.serialize));
+
+	if (calibrate_profiler(cache, 10 * args.nrounds, buffer->data) < 0) {
+		dprintf("unable to calibrate the profiler.\n");
+		goto err_del_cache;
+	}
+
+	printf("Calibrated: baseline %" PRIu64 ", hit %" PRIu64 ", miss %" PRIu64
+		", bound %" PRIu64 ", %zu retries (%lf%% outliers)\n",
+		profile_model.baseline, profile_model.hit,
+		profile_model.miss, profile_model.bound, profile_model.max_retries,
+		100.0 * profile_model.outliers);
+
+	if (args.evict_sets) {
+		printf("\n ---- EVICTION SETS ----\n");
+
+		for (i = 0; i < page_format->nlevels; ++i) {
+			if (find_evict_set(cache, page_format->levels + i, i,
+				args.nrounds, buffer->data) < 0) {
+				printf("PL%zu: using the full eviction buffer\n", i + 1);
+				continue;
+			}
+
+			printf("PL%zu: %zu pages\n", i + 1,
+				cache->evict_sets[i].noffsets);
+		}
+	}
+
+	if (args.evict_bench) {
+		struct evict_bench results[EVICT_NMODES];
+		int mode;
+
+		printf("\n ---- EVICTION MODES ----\n");
+		printf("level\tmode\tcycles\tsuccess\n");
+
+		for (i = 0; i < page_format->nlevels; ++i) {
+			if (bench_evict_modes(results, cache, i, 10 * args.nrounds,
+				buffer->data) < 0)
+				continue;
+
+			for (mode = 0; mode < EVICT_NMODES; ++mode) {
+				printf("%zu\t%s\t%" PRIu64 "\t%lf%%\n", i + 1,
+					get_evict_mode_name(mode), results[mode].cost,
+					results[mode].success);
+			}
+		}
+	}
+
+	if (set_evict_mode(cache, args.evict_mode) < 0) {
+		dprintf("unable to set up the eviction mode.\n");
+		goto err_del_cache;
+	}
+
+	if (args.nwarmup) {
+		struct warm_up_bench warm_up;
+
+		warm_up_profiler(&warm_up, cache, page_format, args.nwarmup,
+			buffer->data);
+
+		printf("\n ---- WARM-UP ----\n");
+		printf("Rounds: %zu\n", args.nwarmup);
+		printf("Retries of the first round: %zu cold, %zu warm\n",
+			warm_up.cold, warm_up.warm);
+
+		if (warm_up.cold >= warm_up.warm)
+			printf("Retries avoided: %zu\n", warm_up.cold - warm_up.warm);
+		else
+			printf("Retries added: %zu\n", warm_up.warm - warm_up.cold);
+	}
+
+	if (args.capture) {
+		char *path;
+
+		if (args.capture_cpu < 0)
+			args.capture_cpu = pick_capture_cpu(args.cpu, args.timer_cpu);
+
+		if (asprintf(&path, "%s/capture.bin", args.output) < 0)
+			goto err_del_cache;
+
+		capture = start_capture(path, args.capture_cpu);
+		free(path);
+
+		if (!capture) {
+			dprintf("unable to start capturing the samples.\n");
+			goto err_del_cache;
+		}
+	}
+
+	policy.confidence = args.confidence;
+	policy.budget = args.sample_budget;
+	policy.error_rate = args.error_rate;
+	profile_stats = (struct profile_stats){ 0 };
 
 	for (run = 0; run < args.nruns; ++run) {
 		printf("\n ---- RUN %zu ----\n", run);
 
 		unsigned slot_error_distances[page_format->nlevels];
-		slot_errors = profile_page_tables(slot_error_distances, cache, page_format, args.nrounds, buffer->data, run, args.output);
+		double margins[page_format->nlevels];
+		slot_errors = profile_page_tables(slot_error_distances, margins, &joint_slot_errors, &joint_probability, cache, page_format, &policy, args.nrounds, buffer->data, run, args.output);
+
+		for (i = 0; i < page_format->nlevels; ++i) {
+			total_margins[i] += margins[i];
+			min_margins[i] = run ? min(min_margins[i], margins[i]) :
+				margins[i];
+		}
+
+		if (joint_slot_errors >= 0) {
+			joint_errors += (joint_slot_errors > 0);
+			total_probability += joint_probability;
+			++njoint;
+		}
 
 		num_errors += (slot_errors > 0);
 		total_slot_errors += slot_errors;
@@ -142,8 +341,45 @@ int main(int argc, const char *argv[])
 	printf("Total slot error distances: %u (%lf per run)\n",
 		total_slot_error_distances,
 		(double)total_slot_error_distances / args.nruns);
+	printf("Joint failures: %u (%lf%%, %zu total, %lf mean %s)\n",
+		joint_errors,
+		njoint ? (double)joint_errors / njoint * 100 : 0.0,
+		njoint,
+		njoint ? total_probability / njoint : 0.0, get_joint_measure());
+	printf("Confidence (mean/min margin in %s):", get_margin_unit());
+
+	for (i = 0; i < page_format->nlevels; ++i) {
+		printf(" PL%zu %lf/%lf", i + 1, total_margins[i] / args.nruns,
+			min_margins[i]);
+	}
+
+	printf("\n");
+	printf("Retries: %zu (%lf per sample, %zu samples, at most %zu)\n",
+		profile_stats.nretries,
+		profile_stats.nsamples ?
+			(double)profile_stats.nretries / profile_stats.nsamples : 0.0,
+		profile_stats.nsamples,
+		profile_stats.max_retries);
+	printf("Exhausted retry budgets: %zu\n", profile_stats.nexhausted);
+	printf("Refined cells: %zu (%lf per run)\n", profile_stats.nrefined,
+		(double)profile_stats.nrefined / args.nruns);
+	printf("Skipped pages: %zu (%lf per run)\n", profile_stats.nskipped,
+		(double)profile_stats.nskipped / args.nruns);
+
+	if (capture) {
+		printf("Captured samples: %zu (%zu stalls)\n",
+			capture->nsamples + capture->active->nsamples,
+			capture->nstalls);
+
+		if (stop_capture(capture) < 0)
+			dprintf("unable to save all the captured samples.\n");
+
+		capture = NULL;
+	}
 
 	ret = 0;
+
+err_del_cache:
 	del_cache(cache);
 
 err_del_buffer:
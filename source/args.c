@@ -10,8 +10,14 @@
 
 #include <getopt.h>
 
+#include "aggregate.h"
 #include "args.h"
+#include "cache.h"
 #include "paging.h"
+#include "profile.h"
+#include "record.h"
+#include "solver.h"
+#include "timer.h"
 
 int parse_addr(uintptr_t *addr, const char *s)
 {
@@ -80,6 +86,42 @@ int parse_array(size_t *values, size_t nvalues, const char *s)
 	return 0;
 }
 
+/* Parses a comma-separated list of aggregators, one for every page level. A
+ * single aggregator is used for every page level.
+ */
+static int parse_aggregators(int *aggregators, size_t naggregators,
+	const char *s)
+{
+	char *str, *p, *name;
+	size_t i;
+	int ret = -1;
+
+	if (!(str = strdup(s)))
+		return -1;
+
+	for (i = 0, p = str; i < naggregators; ++i) {
+		if (!(name = strsep(&p, ",")))
+			break;
+
+		if ((aggregators[i] = get_aggregator(name)) < 0)
+			goto err_free_str;
+	}
+
+	if (p)
+		goto err_free_str;
+
+	if (i == 1) {
+		for (; i < naggregators; ++i)
+			aggregators[i] = aggregators[0];
+	}
+
+	ret = 0;
+
+err_free_str:
+	free(str);
+	return ret;
+}
+
 void print_size(FILE *f, size_t size)
 {
 	if (size == 0) {
@@ -111,15 +153,33 @@ void show_usage(const char *prog_name)
 		"More help:\n"
 		" --list-page-formats: shows the supported page formats for "
 		"the current architecture.\n"
+		" --list-timers: shows the supported timers for the current "
+		"architecture and platform.\n"
 		"\n"
 		"General arguments:\n"
 		" -h, --help: shows this help message\n"
 		" -o, --output <path>: path to the directory in which to store the "
 		"results (default './results')\n"
+		" -i, --input <path>: path to the directory with the results "
+		"to replay (default './results')\n"
+		" --threads <value>: number of threads to replay the runs with "
+		"(default: one per CPU)\n"
+		" --cores <value>: number of physical cores to probe the "
+		"candidates of revanc on at the same time, which share the "
+		"LLC and add noise (default 1)\n"
+		" --save-timings <value>: save the timings of every run as "
+		"binary, text (default) or both.\n"
+		" --capture: stream every sample of every round to capture.bin "
+		"in the output directory using a separate writer thread.\n"
+		" --capture-cpu <value>: the CPU to pin the writer thread of "
+		"--capture to (default: another CPU than --cpu).\n"
 		" -n, --runs <value>: number of runs to perform with the same VA and "
-		"eviction buffers (default 1)\n"
+		"eviction buffers (default 1, or for revanc as many as its "
+		"sequential test takes on average at --threshold)\n"
 		" -r, --rounds <value>: number of measurement rounds (median "
 		"is chosen, default 10)\n"
+		" --warmup <value>: number of discarded rounds over every page "
+		"before measuring (default 0)\n"
 		"\n"
 		"Tuning arguments:\n"
 		" -s, --cache-size <value>: total cache size to evict (LLC "
@@ -131,6 +191,52 @@ void show_usage(const char *prog_name)
 		"current architecture (see --list-page-formats)\n"
 		" --target <addr>: the address to allocate the target buffer "
 		"at.\n"
+		" --timer <value>: the timer to take timestamps with (see "
+		"--list-timers).\n"
+		" --timer-cpu <value>: the CPU to pin the counting thread of "
+		"the thread timer to (default: another CPU than --cpu).\n"
+		" --timer-ns: report timings in nanoseconds using the "
+		"calibrated rate of the timer.\n"
+		" --aggregate <value>[,<value>...]: the estimator to reduce "
+		"the rounds of a cache line with, per page level: median "
+		"(default), remedian, trimmed-mean, min or mode.\n"
+		" --solver-threads <value>: number of threads to score the "
+		"candidate lines and pages with (default 1).\n"
+		" --confidence <value>: measure the cells that separate the "
+		"best solutions of a page level again until the margin of the "
+		"best solution reaches this value, as a fraction of the pages "
+		"with --score=sum or as a log-likelihood ratio in nats with "
+		"--score=likelihood (default 0, disabled).\n"
+		" --sample-budget <value>: number of samples a page level may "
+		"take to reach the confidence (default: as many as profiling "
+		"the page level takes).\n"
+		" --early-stop <value>: stop profiling a page level as soon as "
+		"the best solution is significant at this error rate, for "
+		"example 0.01 (default 0, disabled).\n"
+		" --control-lines <value>: let revanc time only the cache line "
+		"of the target and this many control lines of every page "
+		"instead of solving the full page table (default 0, "
+		"disabled).\n"
+		" --sprt-error <value>: the error rate of the sequential test "
+		"that decides whether a candidate of revanc passes "
+		"--threshold (default 0.05).\n"
+		" --score <value>: how to score the candidate lines and pages: "
+		"sum (default) of the normalised timings, or likelihood to fit "
+		"the latencies of cache hits and misses and sum the "
+		"log-likelihood ratios.\n"
+		" --serialize <value>: the instructions that keep the timed "
+		"access within the measurement, or auto to pick the cheapest "
+		"one that does (default).\n"
+		" --evict-sets: reduce the eviction buffer to a minimal "
+		"eviction set per page level before profiling.\n"
+		" --evict-mode <value>: the order in which to touch the eviction "
+		"buffer: linear (default), reverse, zigzag or chase.\n"
+		" --evict-hugepages: back the data eviction buffer by huge "
+		"pages and use a separate buffer to evict the TLBs.\n"
+		" --sparse: only map the pages of the target and TLB eviction "
+		"buffers that are accessed.\n"
+		" --evict-bench: report the cost and eviction success rate of "
+		"every eviction mode before profiling.\n"
 		"\n"
 		"Per-page level tuning arguments:\n"
 		" --pl[1-4]-entries <value>: number of entries to access to "
@@ -235,11 +341,39 @@ int parse_args(struct args *args, int argc, const char *argv[])
 		{ "runs", required_argument, 0, OPTION_RUNS },
 		{ "threshold", required_argument, 0, OPTION_THRESHOLD },
 		{ "output", required_argument, 0, OPTION_OUTPUT },
+		{ "evict-sets", no_argument, NULL, OPTION_EVICT_SETS },
+		{ "evict-mode", required_argument, 0, OPTION_EVICT_MODE },
+		{ "evict-bench", no_argument, NULL, OPTION_EVICT_BENCH },
+		{ "evict-hugepages", no_argument, NULL, OPTION_EVICT_HUGEPAGES },
+		{ "sparse", no_argument, NULL, OPTION_SPARSE },
+		{ "warmup", required_argument, NULL, OPTION_WARMUP },
+		{ "timer", required_argument, NULL, OPTION_TIMER },
+		{ "list-timers", no_argument, NULL, OPTION_LIST_TIMERS },
+		{ "timer-cpu", required_argument, NULL, OPTION_TIMER_CPU },
+		{ "timer-ns", no_argument, NULL, OPTION_TIMER_NS },
+		{ "serialize", required_argument, NULL, OPTION_SERIALIZE },
+		{ "aggregate", required_argument, NULL, OPTION_AGGREGATE },
+		{ "solver-threads", required_argument, NULL,
+			OPTION_SOLVER_THREADS },
+		{ "confidence", required_argument, NULL, OPTION_CONFIDENCE },
+		{ "sample-budget", required_argument, NULL,
+			OPTION_SAMPLE_BUDGET },
+		{ "early-stop", required_argument, NULL, OPTION_EARLY_STOP },
+		{ "score", required_argument, NULL, OPTION_SCORE },
+		{ "input", required_argument, NULL, OPTION_INPUT },
+		{ "threads", required_argument, NULL, OPTION_THREADS },
+		{ "cores", required_argument, NULL, OPTION_CORES },
+		{ "save-timings", required_argument, NULL, OPTION_SAVE_TIMINGS },
+		{ "capture", no_argument, NULL, OPTION_CAPTURE },
+		{ "capture-cpu", required_argument, NULL, OPTION_CAPTURE_CPU },
+		{ "control-lines", required_argument, NULL,
+			OPTION_CONTROL_LINES },
+		{ "sprt-error", required_argument, NULL, OPTION_SPRT_ERROR },
 		{ NULL, 0, 0, 0 },
 	};
 	int ret;
 
-	while ((ret = getopt_long(argc, (char * const *)argv, "hc:l:n:s:f:r:o:",
+	while ((ret = getopt_long(argc, (char * const *)argv, "hc:l:n:s:f:r:o:i:",
 		options, NULL)) >= 0) {
 		switch (ret) {
 		case OPTION_HELP: return -1;
@@ -308,11 +442,147 @@ int parse_args(struct args *args, int argc, const char *argv[])
 			if ((parse_size(&args->nruns, optarg)) < 0)
 				return -1;
 
+			if (!args->nruns) {
+				fprintf(stderr, "the number of runs has to be at "
+					"least one.\n\n");
+				return -1;
+			}
+
 			break;
 		case OPTION_THRESHOLD:
 			args->threshold = strtof(optarg, NULL);
+			break;
 		case OPTION_OUTPUT:
 			args->output = strdup(optarg);
+			break;
+		case OPTION_EVICT_SETS:
+			args->evict_sets = 1;
+			break;
+		case OPTION_EVICT_MODE:
+			if ((args->evict_mode = get_evict_mode(optarg)) < 0) {
+				fprintf(stderr, "Supported eviction modes: ");
+				list_evict_modes(stderr);
+				fprintf(stderr, "\n\n");
+				return -1;
+			}
+
+			break;
+		case OPTION_EVICT_BENCH:
+			args->evict_bench = 1;
+			break;
+		case OPTION_EVICT_HUGEPAGES:
+			args->evict_hugepages = 1;
+			break;
+		case OPTION_SPARSE:
+			args->sparse = 1;
+			break;
+		case OPTION_WARMUP:
+			if ((parse_size(&args->nwarmup, optarg)) < 0)
+				return -1;
+
+			break;
+		case OPTION_TIMER:
+			if ((args->timer = get_timer(optarg)) >= 0)
+				break;
+			/* fallthrough */
+		case OPTION_LIST_TIMERS:
+			fprintf(stderr, "Supported timers: ");
+			list_timers(stderr);
+			fprintf(stderr, "\n\n");
+			return -1;
+		case OPTION_TIMER_CPU:
+			args->timer_cpu = strtoul(optarg, NULL, 10);
+			break;
+		case OPTION_TIMER_NS:
+			args->timer_ns = 1;
+			break;
+		case OPTION_AGGREGATE:
+			if (parse_aggregators(args->aggregators, 4, optarg) < 0) {
+				fprintf(stderr, "Supported aggregators: ");
+				list_aggregators(stderr);
+				fprintf(stderr, "\n\n");
+				return -1;
+			}
+
+			break;
+		case OPTION_SOLVER_THREADS:
+			if ((parse_size(&args->nsolver_threads, optarg)) < 0)
+				return -1;
+
+			break;
+		case OPTION_CONFIDENCE:
+			args->confidence = strtod(optarg, NULL);
+			break;
+		case OPTION_INPUT:
+			args->input = strdup(optarg);
+			break;
+		case OPTION_THREADS:
+			if ((parse_size(&args->nthreads, optarg)) < 0)
+				return -1;
+
+			break;
+		case OPTION_CORES:
+			if ((parse_size(&args->ncores, optarg)) < 0)
+				return -1;
+
+			break;
+		case OPTION_CAPTURE:
+			args->capture = 1;
+			break;
+		case OPTION_CAPTURE_CPU:
+			args->capture_cpu = strtoul(optarg, NULL, 10);
+			break;
+		case OPTION_SPRT_ERROR:
+			args->sprt_error = strtod(optarg, NULL);
+			break;
+		case OPTION_CONTROL_LINES:
+			if ((parse_size(&args->ncontrol_lines, optarg)) < 0)
+				return -1;
+
+			break;
+		case OPTION_SAVE_TIMINGS:
+			if (strcmp(optarg, "binary") == 0) {
+				args->record_formats = RECORD_BINARY;
+			} else if (strcmp(optarg, "text") == 0) {
+				args->record_formats = RECORD_TEXT;
+			} else if (strcmp(optarg, "both") == 0) {
+				args->record_formats = RECORD_BINARY | RECORD_TEXT;
+			} else {
+				fprintf(stderr, "Supported formats: binary text both\n\n");
+				return -1;
+			}
+
+			break;
+		case OPTION_SCORE:
+			if ((args->score = get_score_mode(optarg)) < 0) {
+				fprintf(stderr, "Supported score modes: ");
+				list_score_modes(stderr);
+				fprintf(stderr, "\n\n");
+				return -1;
+			}
+
+			break;
+		case OPTION_EARLY_STOP:
+			args->error_rate = strtod(optarg, NULL);
+			break;
+		case OPTION_SAMPLE_BUDGET:
+			if ((parse_size(&args->sample_budget, optarg)) < 0)
+				return -1;
+
+			break;
+		case OPTION_SERIALIZE:
+			if (strcmp(optarg, "auto") == 0) {
+				args->serialize = -1;
+				break;
+			}
+
+			if ((args->serialize = get_serialize_mode(optarg)) < 0) {
+				fprintf(stderr, "Supported serialization modes: auto ");
+				list_serialize_modes(stderr);
+				fprintf(stderr, "\n\n");
+				return -1;
+			}
+
 			break;
 		default:
 			break;
@@ -328,16 +598,36 @@ void print_args(FILE *f, struct args *args, struct page_format *fmt)
 	fprintf(f, "Settings:\n"
 		"  runs: %zu\n"
 		"  rounds: %zu\n"
+		"  warm-up rounds: %zu\n"
+		"  confidence: %lf\n"
+		"  early stop error rate: %lf\n"
 		"  page format: %s\n"
 		"  cache size: ",
 		args->nruns,
 		args->nrounds,
+		args->nwarmup,
+		args->confidence,
+		args->error_rate,
 		args->page_format ? args->page_format : "default");
 	print_size(f, args->cache_size);
 	fprintf(f, "\n"
 		"  cache line size: ");
 	print_size(f, args->line_size);
-	fprintf(f, "\n\n");
+	fprintf(f, "\n"
+		"  eviction mode: %s\n"
+		"  timer: %s\n"
+		"  serialization: %s\n"
+		"  score: %s\n"
+		"  aggregators: %s %s %s %s\n\n",
+		get_evict_mode_name(args->evict_mode),
+		get_timer_name(args->timer),
+		args->serialize < 0 ? "auto" :
+			get_serialize_mode_name(args->serialize),
+		get_score_mode_name(args->score),
+		get_aggregator_name(args->aggregators[0]),
+		get_aggregator_name(args->aggregators[1]),
+		get_aggregator_name(args->aggregators[2]),
+		get_aggregator_name(args->aggregators[3]));
 }
 
 struct page_format *get_page_format_from_args(struct args *args)
@@ -357,6 +647,7 @@ struct page_format *get_page_format_from_args(struct args *args)
 
 	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++level, ++i) {
 		level->npages = args->npages[i];
+		level->aggregator = args->aggregators[i];
 		level->ncache_entries = args->nentries[i];
 	}
 
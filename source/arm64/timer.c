@@ -0,0 +1,23 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+
+#include "profile.h"
+#include "timer.h"
+
+static uint64_t read_cntvct(void)
+{
+	return cntvct();
+}
+
+/* Uses the virtual count of the generic timer, which is accessible from user
+ * space on all common operating systems.
+ */
+struct timer cntvct_timer = {
+	.name = "cntvct",
+	.read = read_cntvct,
+	.kind = TIMER_CNTVCT,
+};
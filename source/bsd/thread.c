@@ -4,6 +4,7 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <pthread.h>
 
@@ -23,3 +24,10 @@ int pin_cpu(size_t i)
 
 	return pthread_setaffinity_np(thread, sizeof cpu_set, &cpu_set);
 }
+
+size_t get_cpu_count(void)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return ncpus > 0 ? (size_t)ncpus : 1;
+}
@@ -0,0 +1,79 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdlib.h>
+
+#include "buffer.h"
+#include "macros.h"
+#include "paging.h"
+#include "sparse.h"
+
+/* Maps only the pages of the target buffer that the profiler accesses: for
+ * every page level, the pages at every page size stride, each covering the
+ * cache lines of a page table.
+ */
+int map_sparse_buffer(struct buffer *buffer, struct page_format *fmt,
+	void *target)
+{
+	struct page_level *level;
+	size_t *offsets;
+	size_t noffsets = 0, length = 0;
+	size_t i, j;
+	int ret;
+
+	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
+		noffsets += level->npages;
+		length = max(length, level->table_size);
+	}
+
+	if (!(offsets = malloc(max(noffsets, 1) * sizeof *offsets)))
+		return -1;
+
+	noffsets = 0;
+
+	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
+		for (j = 0; j < level->npages; ++j)
+			offsets[noffsets++] = j * level->page_size;
+	}
+
+	ret = map_sparse(&buffer->map, target, offsets, noffsets, length);
+	free(offsets);
+
+	if (ret < 0)
+		return -1;
+
+	buffer->data = buffer->map.base;
+	buffer->size = buffer->map.ranges[2 * buffer->map.nranges - 1];
+
+	return 0;
+}
+
+/* Touches every page of the target buffer that the profiler accesses, such
+ * that the data pages and the page tables mapping them are populated before
+ * profiling rather than being faulted in while the accesses are timed.
+ * Returns the number of page accesses.
+ */
+size_t prefault_buffer(struct buffer *buffer, struct page_format *fmt)
+{
+	struct page_level *level;
+	volatile char *page;
+	size_t step = fmt->levels[0].page_size;
+	size_t npages = 0;
+	size_t offset;
+	size_t i, j;
+
+	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
+		for (j = 0; j < level->npages; ++j) {
+			page = buffer->data + j * level->page_size;
+
+			for (offset = 0; offset < level->table_size; offset += step) {
+				page[offset] = 0x5A;
+				++npages;
+			}
+		}
+	}
+
+	return npages;
+}
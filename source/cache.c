@@ -0,0 +1,445 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "paging.h"
+#include "macros.h"
+#include "shuffle.h"
+#include "sparse.h"
+
+static const char *evict_modes[] = {
+	[EVICT_LINEAR] = "linear",
+	[EVICT_REVERSE] = "reverse",
+	[EVICT_ZIGZAG] = "zigzag",
+	[EVICT_CHASE] = "chase",
+};
+
+static int cmp_size(const void *lhs_, const void *rhs_)
+{
+	const size_t *lhs = lhs_, *rhs = rhs_;
+
+	if (*lhs < *rhs)
+		return -1;
+
+	if (*lhs > *rhs)
+		return 1;
+
+	return 0;
+}
+
+/* Maps only the pages of the TLB eviction buffer that the eviction plans
+ * access: for every page level, the pages at every stride used to evict the
+ * TLBs and page structure caches, each covering the cache lines of a page
+ * table.
+ */
+int map_sparse_tlb(struct cache *cache, void *target)
+{
+	struct page_format *fmt = cache->fmt;
+	struct page_level *level, *last;
+	size_t *offsets;
+	size_t noffsets = 0, length = 0;
+	size_t stride;
+	size_t i, j, k;
+	int ret;
+
+	for (j = 0, level = fmt->levels; j < fmt->nlevels; ++j, ++level) {
+		noffsets += (fmt->nlevels - j) * level->ncache_entries;
+		length = max(length, level->table_size);
+	}
+
+	if (!(offsets = malloc(max(noffsets, 1) * sizeof *offsets)))
+		return -1;
+
+	noffsets = 0;
+
+	for (k = 0, last = fmt->levels; k < fmt->nlevels; ++k, ++last) {
+		for (j = 0, level = fmt->levels; j <= k; ++j, ++level) {
+			stride = max(level->page_size, last->table_size);
+
+			for (i = 0; i < level->ncache_entries; ++i)
+				offsets[noffsets++] = i * stride;
+		}
+	}
+
+	if (!noffsets)
+		offsets[noffsets++] = 0;
+
+	ret = map_sparse(&cache->tlb_map, target, offsets, noffsets, length);
+	free(offsets);
+
+	if (ret < 0)
+		return -1;
+
+	cache->tlb = cache->tlb_map.base;
+	cache->tlb_size = cache->tlb_map.ranges[2 * cache->tlb_map.nranges - 1];
+
+	return 0;
+}
+
+/* Touches every page of the eviction buffers that the eviction plans access,
+ * such that evicting a cache line does not take page faults the first time
+ * around, without changing their contents. Returns the number of page accesses.
+ */
+size_t prefault_cache(struct cache *cache)
+{
+	struct page_format *fmt = cache->fmt;
+	struct evict_plan *plan;
+	volatile char *p;
+	size_t step = fmt->levels[0].page_size;
+	size_t table_size;
+	size_t npages = 0;
+	size_t offset;
+	size_t i, j;
+
+	if (!cache->plans)
+		return 0;
+
+	for (i = 0, plan = cache->plans; i < fmt->nlevels; ++i, ++plan) {
+		table_size = fmt->levels[i].table_size;
+
+		for (j = 0; j < plan->noffsets; ++j) {
+			p = (j < plan->ndata ? cache->data : cache->tlb) +
+				get_plan_offset(plan, j);
+
+			/* Write back what is there, as the pages may already
+			 * hold the pointers of EVICT_CHASE, while a mere load
+			 * would only map the shared zero page.
+			 */
+			for (offset = 0; offset < table_size; offset += step) {
+				p[offset] = p[offset];
+				++npages;
+			}
+		}
+	}
+
+	return npages;
+}
+
+static void del_evict_chains(struct evict_plan *plan)
+{
+	free(plan->chains);
+	plan->chains = NULL;
+}
+
+/* Links the addresses of the eviction plan of the given page level into a
+ * randomly ordered list for every cache line, such that evict_cache_line()
+ * can traverse them by chasing pointers. As the same address may be part of
+ * the plans of several page levels, every page level stores its pointers in
+ * a different word of the cache line.
+ */
+static int build_evict_chains(struct cache *cache, size_t page_level)
+{
+	struct evict_plan *plan = cache->plans + page_level;
+	size_t ncache_lines = cache->fmt->levels[page_level].table_size /
+		cache->line_size;
+	size_t word = page_level * sizeof(void *);
+	uint32_t *order;
+	void **p, **prev;
+	char *base;
+	size_t i, j;
+
+	if (word + sizeof(void *) > cache->line_size) {
+		dprintf("cache lines are too small to chase pointers.\n");
+		return -1;
+	}
+
+	del_evict_chains(plan);
+
+	if (!(plan->chains = calloc(max(ncache_lines, 1), sizeof *plan->chains)))
+		return -1;
+
+	if (!plan->noffsets)
+		return 0;
+
+	if (!(order = malloc(plan->noffsets * sizeof *order)))
+		goto err_del_chains;
+
+	for (j = 0; j < plan->noffsets; ++j)
+		order[j] = (uint32_t)j;
+
+	for (i = 0; i < ncache_lines; ++i) {
+		shuffle(order, plan->noffsets, sizeof *order);
+		prev = plan->chains + i;
+
+		for (j = 0; j < plan->noffsets; ++j) {
+			base = (order[j] < plan->ndata) ? cache->data : cache->tlb;
+			p = (void **)(base + i * cache->line_size + word +
+				get_plan_offset(plan, order[j]));
+			*prev = p;
+			prev = p;
+		}
+
+		*prev = NULL;
+	}
+
+	free(order);
+	return 0;
+
+err_del_chains:
+	del_evict_chains(plan);
+	return -1;
+}
+
+/* Sorts the given offsets and removes the duplicates. Returns the number of
+ * offsets that are left.
+ */
+static size_t sort_offsets(size_t *offsets, size_t noffsets)
+{
+	size_t i, j;
+
+	qsort(offsets, noffsets, sizeof *offsets, cmp_size);
+
+	for (i = 0, j = 0; i < noffsets; ++i) {
+		if (j && offsets[j - 1] == offsets[i])
+			continue;
+
+		offsets[j++] = offsets[i];
+	}
+
+	return j;
+}
+
+/* Compiles the offsets that evict_cache_line() has to touch for the given
+ * page level: one offset per page table in the eviction buffer (or per page
+ * in the reduced eviction set) to flush the cache line from the data cache,
+ * followed by the offsets needed to flush the TLBs and page structure caches
+ * of every page level up to the given one. The offsets of both passes are
+ * sorted and deduplicated, such that every address is only touched once.
+ * If both passes share the same buffer, they are merged as well.
+ */
+static int build_evict_plan(struct cache *cache, size_t page_level)
+{
+	struct page_format *fmt = cache->fmt;
+	struct page_level *level;
+	struct evict_plan *plan = cache->plans + page_level;
+	struct evict_set *evict_set = NULL;
+	size_t table_size = fmt->levels[page_level].table_size;
+	size_t *offsets;
+	uint32_t *compact;
+	size_t noffsets, ndata, nsweep, ntlb = 0;
+	size_t stride, mask = table_size;
+	size_t i, j;
+	unsigned shift;
+
+	if (cache->evict_sets && cache->evict_sets[page_level].noffsets)
+		evict_set = cache->evict_sets + page_level;
+
+	nsweep = evict_set ? evict_set->noffsets : cache->cache_size / table_size;
+
+	for (j = 0, level = fmt->levels; j <= page_level; ++j, ++level)
+		ntlb += level->ncache_entries;
+
+	if (!(offsets = malloc(max(nsweep + ntlb, 1) * sizeof *offsets)))
+		return -1;
+
+	for (i = 0; i < nsweep; ++i) {
+		offsets[i] = evict_set ? evict_set->offsets[i] : i * table_size;
+	}
+
+	noffsets = nsweep;
+
+	for (j = 0, level = fmt->levels; j <= page_level; ++j, ++level) {
+		stride = max(level->page_size, table_size);
+
+		for (i = 0; i < level->ncache_entries; ++i)
+			offsets[noffsets++] = i * stride;
+	}
+
+	if (cache->tlb == cache->data) {
+		noffsets = ndata = sort_offsets(offsets, noffsets);
+	} else {
+		ndata = sort_offsets(offsets, nsweep);
+		memmove(offsets + ndata, offsets + nsweep, ntlb * sizeof *offsets);
+		noffsets = ndata + sort_offsets(offsets + ndata, ntlb);
+	}
+
+	for (i = 0; i < noffsets; ++i)
+		mask |= offsets[i];
+
+	shift = __builtin_ctzll((unsigned long long)mask);
+
+	for (i = 0; i < noffsets && (offsets[i] >> shift) <= UINT32_MAX; ++i);
+
+	/* Keep the full offsets if they do not fit in 32 bits. */
+	if (i == noffsets) {
+		if (!(compact = malloc(max(noffsets, 1) * sizeof *compact)))
+			goto err_free_offsets;
+
+		for (i = 0; i < noffsets; ++i)
+			compact[i] = (uint32_t)(offsets[i] >> shift);
+
+		free(offsets);
+		offsets = NULL;
+	} else {
+		compact = NULL;
+		shift = 0;
+	}
+
+	free(plan->offsets);
+	free(plan->wide_offsets);
+	plan->offsets = compact;
+	plan->wide_offsets = offsets;
+	plan->noffsets = noffsets;
+	plan->ndata = ndata;
+	plan->shift = shift;
+
+	if (cache->evict_mode == EVICT_CHASE)
+		return build_evict_chains(cache, page_level);
+
+	return 0;
+
+err_free_offsets:
+	free(offsets);
+	return -1;
+}
+
+int build_evict_plans(struct cache *cache)
+{
+	size_t i;
+
+	if (!cache->plans && !(cache->plans = calloc(cache->fmt->nlevels,
+		sizeof *cache->plans)))
+		return -1;
+
+	for (i = 0; i < cache->fmt->nlevels; ++i) {
+		if (build_evict_plan(cache, i) < 0)
+			goto err_del_plans;
+	}
+
+	return 0;
+
+err_del_plans:
+	del_evict_plans(cache);
+	return -1;
+}
+
+void del_evict_plans(struct cache *cache)
+{
+	size_t i;
+
+	if (!cache->plans)
+		return;
+
+	for (i = 0; i < cache->fmt->nlevels; ++i) {
+		free(cache->plans[i].offsets);
+		free(cache->plans[i].wide_offsets);
+		del_evict_chains(cache->plans + i);
+	}
+
+	free(cache->plans);
+	cache->plans = NULL;
+}
+
+int get_evict_mode(const char *name)
+{
+	int mode;
+
+	for (mode = 0; mode < EVICT_NMODES; ++mode) {
+		if (strcmp(name, evict_modes[mode]) == 0)
+			return mode;
+	}
+
+	return -1;
+}
+
+const char *get_evict_mode_name(int mode)
+{
+	if (mode < 0 || mode >= EVICT_NMODES)
+		return NULL;
+
+	return evict_modes[mode];
+}
+
+void list_evict_modes(FILE *f)
+{
+	int mode;
+
+	for (mode = 0; mode < EVICT_NMODES; ++mode) {
+		fprintf(f, "%s ", evict_modes[mode]);
+	}
+}
+
+/* Selects the order in which evict_cache_line() traverses the eviction
+ * plans. The pointer chasing lists are built on demand and dropped again
+ * when switching to another mode, as the other modes overwrite them.
+ */
+int set_evict_mode(struct cache *cache, int mode)
+{
+	size_t i;
+
+	if (mode < 0 || mode >= EVICT_NMODES)
+		return -1;
+
+	cache->evict_mode = mode;
+	cache->zigzag = 0;
+
+	if (!cache->plans)
+		return 0;
+
+	for (i = 0; i < cache->fmt->nlevels; ++i) {
+		if (mode != EVICT_CHASE) {
+			del_evict_chains(cache->plans + i);
+			continue;
+		}
+
+		if (build_evict_chains(cache, i) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Replaces the eviction set of the given page level by a copy of the given
+ * page offsets. Passing no offsets restores the full sweep over the eviction
+ * buffer for that page level.
+ */
+int set_evict_set(struct cache *cache, size_t page_level, size_t *offsets,
+	size_t noffsets)
+{
+	struct evict_set *evict_set;
+	size_t *copy = NULL;
+
+	if (!cache->evict_sets && !(cache->evict_sets = calloc(
+		cache->fmt->nlevels, sizeof *cache->evict_sets)))
+		return -1;
+
+	if (noffsets) {
+		if (!(copy = malloc(noffsets * sizeof *copy)))
+			return -1;
+
+		memcpy(copy, offsets, noffsets * sizeof *copy);
+	}
+
+	evict_set = cache->evict_sets + page_level;
+	free(evict_set->offsets);
+	evict_set->offsets = copy;
+	evict_set->noffsets = noffsets;
+
+	if (!cache->plans)
+		return 0;
+
+	return build_evict_plan(cache, page_level);
+}
+
+void clear_evict_sets(struct cache *cache)
+{
+	size_t i;
+
+	if (!cache->evict_sets)
+		return;
+
+	for (i = 0; i < cache->fmt->nlevels; ++i)
+		free(cache->evict_sets[i].offsets);
+
+	free(cache->evict_sets);
+	cache->evict_sets = NULL;
+
+	if (cache->plans)
+		build_evict_plans(cache);
+}
@@ -0,0 +1,175 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "capture.h"
+#include "macros.h"
+#include "thread.h"
+
+struct capture *capture;
+
+_Static_assert(sizeof(struct capture_sample) == 16,
+	"unexpected layout of struct capture_sample");
+
+/* Hands the active buffer over to the writer thread and continues with the
+ * other one. If the writer thread has not drained that one yet, this spins
+ * rather than sleeping, as sleeping would be a system call.
+ */
+void swap_capture_buffer(struct capture *capture)
+{
+	struct capture_buffer *next = capture->buffers +
+		(capture->active == capture->buffers);
+
+	capture->nsamples += capture->active->nsamples;
+	atomic_store_explicit(&capture->active->full, 1, memory_order_release);
+
+	if (atomic_load_explicit(&next->full, memory_order_acquire)) {
+		++capture->nstalls;
+
+		while (atomic_load_explicit(&next->full, memory_order_acquire));
+	}
+
+	capture->active = next;
+}
+
+/* Drains the full buffers in turn until asked to stop. */
+static void *drain_capture(void *data)
+{
+	struct capture *capture = data;
+	struct capture_buffer *buffer = capture->buffers;
+	struct timespec delay = { .tv_nsec = 100000 };
+
+	atomic_store(&capture->state,
+		(capture->cpu < 0 || pin_cpu(capture->cpu) == 0) ? 1 : -1);
+
+	for (;;) {
+		while (!atomic_load_explicit(&buffer->full, memory_order_acquire)) {
+			/* The last buffer is handed over before stopping. */
+			if (atomic_load(&capture->stop) &&
+				!atomic_load_explicit(&buffer->full,
+				memory_order_acquire))
+				return NULL;
+
+			nanosleep(&delay, NULL);
+		}
+
+		if (fwrite(buffer->samples, sizeof *buffer->samples,
+			buffer->nsamples, capture->f) != buffer->nsamples)
+			atomic_store(&capture->state, -1);
+
+		buffer->nsamples = 0;
+		atomic_store_explicit(&buffer->full, 0, memory_order_release);
+		buffer = capture->buffers + (buffer == capture->buffers);
+	}
+
+	return NULL;
+}
+
+/* Creates the capture file at the given path, allocates and prefaults the
+ * buffers and starts the writer thread pinned to the given CPU, or unpinned
+ * if the CPU is negative. The samples are only captured while armed.
+ */
+struct capture *start_capture(const char *path, int cpu)
+{
+	struct capture *capture;
+	struct capture_header header = {
+		.version = CAPTURE_VERSION,
+		.sample_size = sizeof(struct capture_sample),
+	};
+	size_t i;
+
+	if (!(capture = calloc(1, sizeof *capture)))
+		return NULL;
+
+	for (i = 0; i < 2; ++i) {
+		if (!(capture->buffers[i].samples = malloc(CAPTURE_NSAMPLES *
+			sizeof *capture->buffers[i].samples)))
+			goto err_free_buffers;
+
+		memset(capture->buffers[i].samples, 0, CAPTURE_NSAMPLES *
+			sizeof *capture->buffers[i].samples);
+		atomic_init(&capture->buffers[i].full, 0);
+	}
+
+	capture->active = capture->buffers;
+	capture->cpu = cpu;
+	atomic_init(&capture->state, 0);
+	atomic_init(&capture->stop, 0);
+
+	if (!(capture->f = fopen(path, "wb")))
+		goto err_free_buffers;
+
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof header.magic);
+
+	if (fwrite(&header, sizeof header, 1, capture->f) != 1)
+		goto err_close;
+
+	if (pthread_create(&capture->thread, NULL, drain_capture, capture) != 0)
+		goto err_close;
+
+	/* Yield rather than spin, as the writer thread may have to run on
+	 * this CPU to report back.
+	 */
+	while (!atomic_load(&capture->state))
+		sched_yield();
+
+	if (atomic_load(&capture->state) < 0) {
+		dprintf("unable to pin the capture thread to CPU %d.\n", cpu);
+		atomic_store(&capture->stop, 1);
+		pthread_join(capture->thread, NULL);
+		goto err_close;
+	}
+
+	return capture;
+
+err_close:
+	fclose(capture->f);
+err_free_buffers:
+	for (i = 0; i < 2; ++i)
+		free(capture->buffers[i].samples);
+
+	free(capture);
+	return NULL;
+}
+
+/* Hands the remaining samples over to the writer thread, waits for it to
+ * drain them and releases the capture.
+ */
+int stop_capture(struct capture *capture)
+{
+	size_t i;
+	int ret;
+
+	if (!capture)
+		return -1;
+
+	capture->armed = 0;
+
+	if (capture->active->nsamples)
+		swap_capture_buffer(capture);
+
+	atomic_store(&capture->stop, 1);
+	pthread_join(capture->thread, NULL);
+	ret = atomic_load(&capture->state) < 0 ? -1 : 0;
+
+	if (fclose(capture->f) != 0)
+		ret = -1;
+
+	for (i = 0; i < 2; ++i)
+		free(capture->buffers[i].samples);
+
+	free(capture);
+
+	return ret;
+}
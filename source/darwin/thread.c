@@ -4,6 +4,7 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <mach/thread_act.h>
 #include <mach/thread_policy.h>
@@ -18,3 +19,10 @@ int pin_cpu(size_t i)
 
         return 0;
 }
+
+size_t get_cpu_count(void)
+{
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return ncpus > 0 ? (size_t)ncpus : 1;
+}
@@ -0,0 +1,197 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "joint.h"
+#include "macros.h"
+#include "solver.h"
+
+/* The number of solutions per page level to combine. */
+#define JOINT_NSOLUTIONS 8
+
+/* The best solutions of a page level, the part of the score of every
+ * solution that falls in each cache line, and the score of every cache line
+ * over all pages.
+ */
+struct joint_table {
+	struct solution solutions[JOINT_NSOLUTIONS];
+	size_t nsolutions;
+	double *cells;
+	double *columns;
+};
+
+static int init_joint_table(struct joint_table *table,
+	struct joint_level *level)
+{
+	struct solution *solution;
+	size_t ncache_lines = level->ncache_lines;
+	size_t row, col;
+	size_t i;
+
+	if (!(table->nsolutions = rank_lines(table->solutions, JOINT_NSOLUTIONS,
+		level->timings, ncache_lines, level->npages,
+		level->npages_per_line)))
+		return -1;
+
+	if (!(table->cells = calloc(table->nsolutions * ncache_lines,
+		sizeof *table->cells)))
+		return -1;
+
+	if (!(table->columns = calloc(ncache_lines, sizeof *table->columns)))
+		goto err_free_cells;
+
+	for (row = 0; row < level->npages; ++row) {
+		for (col = 0; col < ncache_lines; ++col)
+			table->columns[col] += level->timings[row * ncache_lines + col];
+	}
+
+	for (i = 0, solution = table->solutions; i < table->nsolutions; ++i,
+		++solution) {
+		for (row = 0; row < level->npages; ++row) {
+			col = (solution->line + (row + solution->page) /
+				level->npages_per_line) % ncache_lines;
+			table->cells[i * ncache_lines + col] +=
+				level->timings[row * ncache_lines + col];
+		}
+	}
+
+	return 0;
+
+err_free_cells:
+	free(table->cells);
+	return -1;
+}
+
+/* Scores a solution of a page level given the slots that the other page
+ * levels use. The cache lines of these slots show up as vertical stripes in
+ * the timings of the page level, at the same lines that filter_signals()
+ * derives from the target address. The cells of the solution that fall into
+ * them are explained by the stripes instead, and the stripes add their own
+ * score. Slots beyond the cache lines of the page level leave no stripe.
+ */
+static double score_joint_table(struct joint_table *table,
+	struct joint_level *level, size_t k, size_t *slots, size_t nslots)
+{
+	double score = table->solutions[k].score;
+	size_t lines[nslots];
+	size_t i, j, n = 0;
+
+	for (i = 0; i < nslots; ++i) {
+		lines[n] = slots[i] / level->npages_per_line;
+
+		if (lines[n] >= level->ncache_lines)
+			continue;
+
+		for (j = 0; j < n && lines[j] != lines[n]; ++j);
+
+		/* Count every stripe once. */
+		if (j < n)
+			continue;
+
+		score += table->columns[lines[n]] -
+			table->cells[k * level->ncache_lines + lines[n]];
+		++n;
+	}
+
+	return score;
+}
+
+/* Returns the slot of solution k of the given page level. */
+static size_t get_joint_slot(struct joint_table *table,
+	struct joint_level *level, size_t k)
+{
+	return table->solutions[k].line * level->npages_per_line +
+		table->solutions[k].page;
+}
+
+/* Combines the best solutions of every page level into candidates for the
+ * virtual address and scores them jointly: the slot that a page level picks
+ * has to show up as a vertical stripe in the timings of every other page
+ * level. Stores the slots of the best candidate. Only likelihood scores are
+ * log-likelihoods, in which case this returns the posterior of the best
+ * candidate over all the candidates. Otherwise, this returns the margin
+ * between the best and the second best candidate, normalised by the number of
+ * pages of all page levels like get_margin(). Returns a negative value on
+ * failure.
+ */
+double solve_joint(size_t *slots, struct joint_level *levels, size_t nlevels)
+{
+	struct joint_table *tables;
+	size_t choice[nlevels], other_slots[nlevels];
+	size_t i, j, n, nready, npages = 0;
+	double score, best = -INFINITY, second = -INFINITY, total = 0;
+	double ret;
+
+	if (!nlevels || !(tables = calloc(nlevels, sizeof *tables)))
+		return -1;
+
+	for (nready = 0; nready < nlevels; ++nready) {
+		if (init_joint_table(tables + nready, levels + nready) < 0)
+			goto err_free_tables;
+	}
+
+	memset(choice, 0, sizeof choice);
+
+	for (;;) {
+		for (i = 0, score = 0; i < nlevels; ++i) {
+			/* The slots of the other page levels. */
+			for (j = 0, n = 0; j < nlevels; ++j) {
+				if (j != i)
+					other_slots[n++] = get_joint_slot(tables + j,
+						levels + j, choice[j]);
+			}
+
+			score += score_joint_table(tables + i, levels + i,
+				choice[i], other_slots, n);
+		}
+
+		/* Keep a running log-sum-exp relative to the best score. */
+		if (score > best) {
+			total = total * exp(best - score) + 1;
+			second = best;
+			best = score;
+
+			for (i = 0; i < nlevels; ++i)
+				slots[i] = get_joint_slot(tables + i, levels + i,
+					choice[i]);
+		} else {
+			total += exp(score - best);
+			second = max(second, score);
+		}
+
+		for (i = 0; i < nlevels && ++choice[i] == tables[i].nsolutions; ++i)
+			choice[i] = 0;
+
+		if (i == nlevels)
+			break;
+	}
+
+	for (i = 0; i < nlevels; ++i) {
+		npages += levels[i].npages;
+		free(tables[i].columns);
+		free(tables[i].cells);
+	}
+
+	free(tables);
+
+	if (get_current_score_mode() == SCORE_LIKELIHOOD)
+		return 1.0 / total;
+
+	ret = isinf(second) ? best : best - second;
+
+	return npages ? max(ret, 0.0) / npages : 0.0;
+
+err_free_tables:
+	for (i = 0; i < nready; ++i) {
+		free(tables[i].columns);
+		free(tables[i].cells);
+	}
+
+	free(tables);
+	return -1;
+}
@@ -0,0 +1,101 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "macros.h"
+#include "profile.h"
+#include "timer.h"
+
+static int perf_fd = -1;
+static volatile struct perf_event_mmap_page *perf_page;
+
+/* Opens a counter for the CPU cycles spent in user space by this thread and
+ * maps its metadata page, which tells whether the counter can be read
+ * directly using RDPMC.
+ */
+static int init_perf(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof attr;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	if ((perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)) < 0)
+		return -1;
+
+	if ((perf_page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ,
+		MAP_SHARED, perf_fd, 0)) == MAP_FAILED) {
+		perf_page = NULL;
+	}
+
+	return 0;
+}
+
+static void fini_perf(void)
+{
+	if (perf_page)
+		munmap((void *)perf_page, sysconf(_SC_PAGESIZE));
+
+	close(perf_fd);
+	perf_page = NULL;
+	perf_fd = -1;
+}
+
+/* Reads the counter using RDPMC if the kernel allows it, following the
+ * protocol of the metadata page, and falls back to read() otherwise.
+ */
+static uint64_t read_perf(void)
+{
+	uint64_t count = 0;
+#if defined(__x86_64__)
+	uint64_t pmc;
+	uint32_t seq, index;
+	unsigned width;
+
+	if (perf_page && perf_page->cap_user_rdpmc) {
+		do {
+			seq = perf_page->lock;
+			asm volatile("" ::: "memory");
+			index = perf_page->index;
+			count = perf_page->offset;
+
+			if (index) {
+				width = perf_page->pmc_width;
+				pmc = rdpmc(index - 1);
+				count += (int64_t)(pmc << (64 - width)) >> (64 - width);
+			}
+
+			asm volatile("" ::: "memory");
+		} while (perf_page->lock != seq);
+
+		if (index)
+			return count;
+	}
+#endif
+
+	if (read(perf_fd, &count, sizeof count) != sizeof count)
+		return 0;
+
+	return count;
+}
+
+/* Uses the CPU cycle counter of the PMU through perf_event_open(). */
+struct timer perf_timer = {
+	.name = "perf",
+	.init = init_perf,
+	.fini = fini_perf,
+	.read = read_perf,
+};
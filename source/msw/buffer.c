@@ -14,7 +14,7 @@
 #include "macros.h"
 #include "paging.h"
 
-struct buffer *new_buffer(struct page_format *fmt, void *target)
+struct buffer *new_buffer(struct page_format *fmt, void *target, int flags)
 {
 	struct buffer *buffer;
 	struct page_level *level;
@@ -22,10 +22,15 @@ struct buffer *new_buffer(struct page_format *fmt, void *target)
 	size_t stride = 0;
 	size_t i, j;
 
-	if (!(buffer = malloc(sizeof *buffer)))
+	if (!(buffer = calloc(1, sizeof *buffer)))
 		return NULL;
 
-	buffer->size = 0;
+	if (flags & BUFFER_SPARSE) {
+		if (map_sparse_buffer(buffer, fmt, target) < 0)
+			goto err_free_buffer;
+
+		return buffer;
+	}
 
 	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
 		stride = level->page_size;
@@ -54,6 +59,10 @@ err_free_buffer:
 
 void del_buffer(struct buffer *buffer)
 {
-	VirtualFree(buffer->data, buffer->size, MEM_RELEASE);
+	if (buffer->map.nranges)
+		unmap_sparse(&buffer->map);
+	else
+		VirtualFree(buffer->data, buffer->size, MEM_RELEASE);
+
 	free(buffer);
 }
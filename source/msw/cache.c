@@ -16,35 +16,93 @@
 #include "paging.h"
 #include "macros.h"
 
+static void del_tlb(struct cache *cache)
+{
+	if (cache->tlb_map.nranges)
+		unmap_sparse(&cache->tlb_map);
+	else if (cache->tlb != cache->data)
+		VirtualFree(cache->tlb, 0, MEM_RELEASE);
+}
+
+/* Allocates the eviction buffer. If huge pages are requested and large pages
+ * are available to the process, the data eviction buffer is backed by large
+ * pages and a separate buffer is used for the TLBs and page structure caches.
+ * The same split is used for a sparse buffer, of which only the pages needed
+ * to evict the TLBs and page structure caches are committed.
+ */
 struct cache *new_cache(struct page_format *fmt, void *target,
-	size_t cache_size, size_t line_size)
+	size_t cache_size, size_t line_size, int flags)
 {
 	struct cache *cache;
 	struct page_level *level;
 	size_t stride = 0;
+	size_t tlb_size = 0;
+	size_t large_page_size;
 	size_t i;
+	int split = !!(flags & CACHE_SPARSE);
 
-	if (!(cache = malloc(sizeof *cache)))
+	if (!(cache = calloc(1, sizeof *cache)))
 		return NULL;
 
 	cache->fmt = fmt;
 	cache->cache_size = cache_size;
 	cache->line_size = line_size;
-	cache->size = cache_size;
+	cache->evict_mode = EVICT_LINEAR;
 
 	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
 		stride = max(level->page_size, level->table_size);
-		cache->size = max(cache->size, level->ncache_entries * stride);
+		tlb_size = max(tlb_size, level->ncache_entries * stride);
+	}
+
+	if ((flags & CACHE_HUGEPAGES) &&
+		(large_page_size = GetLargePageMinimum())) {
+		cache->size = (cache_size + large_page_size - 1) &
+			~(large_page_size - 1);
+
+		if ((cache->data = VirtualAlloc(NULL, cache->size, MEM_RESERVE |
+			MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE))) {
+			cache->flags |= CACHE_HUGETLB;
+			split = 1;
+		}
+	}
+
+	if (!cache->data) {
+		cache->size = split ? cache_size : max(cache_size, tlb_size);
+
+		if (!(cache->data = VirtualAlloc(split ? NULL : target,
+			cache->size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE))) {
+			dperror();
+			goto err_free_cache;
+		}
 	}
 
-	if (!(cache->data = VirtualAlloc(target, cache->size, MEM_RESERVE |
-		MEM_COMMIT, PAGE_READWRITE))) {
-		dperror();
-		goto err_free_cache;
+	if (!split) {
+		cache->tlb = cache->data;
+		cache->tlb_size = cache->size;
+	} else if (flags & CACHE_SPARSE) {
+		if (map_sparse_tlb(cache, target) < 0) {
+			dprintf("unable to map the sparse TLB eviction set.\n");
+			goto err_free_data;
+		}
+	} else {
+		cache->tlb_size = max(tlb_size, 1);
+
+		if (!(cache->tlb = VirtualAlloc(target, cache->tlb_size,
+			MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE))) {
+			dperror();
+			goto err_free_data;
+		}
 	}
 
+	if (build_evict_plans(cache) < 0)
+		goto err_free_tlb;
+
 	return cache;
 
+err_free_tlb:
+	del_tlb(cache);
+err_free_data:
+	VirtualFree(cache->data, 0, MEM_RELEASE);
 err_free_cache:
 	free(cache);
 	return NULL;
@@ -52,6 +110,9 @@ err_free_cache:
 
 void del_cache(struct cache *cache)
 {
-	VirtualFree(cache->data, cache->size, MEM_RELEASE);
+	del_evict_plans(cache);
+	clear_evict_sets(cache);
+	del_tlb(cache);
+	VirtualFree(cache->data, 0, MEM_RELEASE);
 	free(cache);
 }
@@ -12,6 +12,8 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <windows.h>
+
 #include "path.h"
 
 /* If the path does not exist yet, a directory is created for the given path.
@@ -59,3 +61,39 @@ err_free_fpath:
 	free(fpath);
 	return ret;
 }
+
+/* Maps the whole file at the given path read-only and stores its size. */
+void *map_file(size_t *size, const char *path)
+{
+	HANDLE file, mapping;
+	LARGE_INTEGER file_size;
+	void *data = NULL;
+
+	file = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	if (!GetFileSizeEx(file, &file_size) || !file_size.QuadPart)
+		goto err_close_file;
+
+	if (!(mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0,
+		NULL)))
+		goto err_close_file;
+
+	if ((data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)))
+		*size = (size_t)file_size.QuadPart;
+
+	CloseHandle(mapping);
+
+err_close_file:
+	CloseHandle(file);
+	return data;
+}
+
+void unmap_file(void *data, size_t size)
+{
+	(void)size;
+	UnmapViewOfFile(data);
+}
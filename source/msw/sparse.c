@@ -0,0 +1,47 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define WIN32_MEAN_AND_LEAN
+#define NOMINMAX
+#include <windows.h>
+
+#include "sparse.h"
+
+size_t get_map_granularity(void)
+{
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+
+	return info.dwAllocationGranularity;
+}
+
+uintptr_t get_va_limit(void)
+{
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+
+	return (uintptr_t)info.lpMaximumApplicationAddress + 1;
+}
+
+/* VirtualAlloc() fails rather than replacing existing allocations. */
+int map_fixed(void *addr, size_t len)
+{
+	if (!VirtualAlloc(addr, len, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE))
+		return -1;
+
+	return 0;
+}
+
+void unmap_fixed(void *addr, size_t len)
+{
+	(void)len;
+
+	VirtualFree(addr, 0, MEM_RELEASE);
+}
@@ -7,9 +7,37 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "thread.h"
+
 /* Checks if transparent hugepages is enabled or disabled. */
 int check_transparent_hugepages(void)
 {
 	return 0;
 }
 
+/* Returns the first of the SMT siblings of the given CPU, which is the CPU
+ * itself as the topology is unknown.
+ */
+size_t get_core_cpu(size_t cpu)
+{
+	return cpu;
+}
+
+/* Returns the ids of the CPUs, which are numbered 0 up to the number of CPUs,
+ * and stores their number. Returns NULL on failure.
+ */
+size_t *get_online_cpus(size_t *ncpus)
+{
+	size_t *cpus;
+	size_t i, n = get_cpu_count();
+
+	if (!(cpus = malloc(n * sizeof *cpus)))
+		return NULL;
+
+	for (i = 0; i < n; ++i)
+		cpus[i] = i;
+
+	*ncpus = n;
+
+	return cpus;
+}
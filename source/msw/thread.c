@@ -15,3 +15,12 @@ int pin_cpu(size_t i)
 
 	return 0;
 }
+
+size_t get_cpu_count(void)
+{
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+
+	return info.dwNumberOfProcessors;
+}
@@ -0,0 +1,34 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+
+#define WIN32_MEAN_AND_LEAN
+#define NOMINMAX
+#include <windows.h>
+
+#include "timer.h"
+
+static uint64_t read_monotonic(void)
+{
+	static uint64_t freq;
+	LARGE_INTEGER count;
+
+	if (!freq) {
+		QueryPerformanceFrequency(&count);
+		freq = (uint64_t)count.QuadPart;
+	}
+
+	QueryPerformanceCounter(&count);
+
+	return (uint64_t)count.QuadPart / freq * 1000000000 +
+		(uint64_t)count.QuadPart % freq * 1000000000 / freq;
+}
+
+/* Uses the performance counter of the system in nanoseconds. */
+struct timer monotonic_timer = {
+	.name = "monotonic",
+	.read = read_monotonic,
+};
@@ -16,7 +16,8 @@
 #define MAP_NORESERVE 0
 #endif /* MAP_NORESERVE */
 
-struct buffer *new_buffer(struct page_format *fmt, void *target)
+struct buffer *new_buffer(struct page_format *fmt, void *target,
+	int buffer_flags)
 {
 	struct buffer *buffer;
 	struct page_level *level;
@@ -30,6 +31,15 @@ struct buffer *new_buffer(struct page_format *fmt, void *target)
 	if (!(buffer = calloc(1,sizeof *buffer)))
 		return NULL;
 
+	if (buffer_flags & BUFFER_SPARSE) {
+		if (map_sparse_buffer(buffer, fmt, target) < 0) {
+			dprintf("unable to map the sparse target buffer.\n");
+			goto err_free_buffer;
+		}
+
+		return buffer;
+	}
+
 	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
 		stride = level->page_size;
 		buffer->size = max(buffer->size, level->npages * stride);
@@ -50,6 +60,10 @@ err_free_buffer:
 
 void del_buffer(struct buffer *buffer)
 {
-	munmap(buffer->data, buffer->size);
+	if (buffer->map.nranges)
+		unmap_sparse(&buffer->map);
+	else
+		munmap(buffer->data, buffer->size);
+
 	free(buffer);
 }
@@ -4,6 +4,7 @@
  */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -18,41 +19,235 @@
 #define MAP_NORESERVE 0
 #endif /* MAP_NORESERVE */
 
+#define HUGE_PAGE_SIZE (2 * MIB)
+
+#if defined(MAP_ALIGNED_SUPER)
+/* Faults in the given buffer and checks whether every huge page of it is
+ * backed by a superpage, as superpages are only ever a best effort.
+ */
+static int check_huge_pages(char *data, size_t size)
+{
+#if defined(MINCORE_SUPER)
+	char vec;
+	size_t i;
+
+	for (i = 0; i < size; i += HUGE_PAGE_SIZE) {
+		data[i] = 0;
+
+		if (mincore(data + i, 1, &vec) < 0 || !(vec & MINCORE_SUPER))
+			return 0;
+	}
+
+	return 1;
+#else
+	(void)data;
+	(void)size;
+
+	return 0;
+#endif
+}
+#elif defined(MADV_HUGEPAGE)
+/* Faults in the given buffer and checks whether it is fully backed by
+ * transparent huge pages according to /proc/self/smaps, as MADV_HUGEPAGE
+ * succeeds even if transparent huge pages are disabled or none are available.
+ */
+static int check_huge_pages(char *data, size_t size)
+{
+	FILE *f;
+	char *line = NULL;
+	size_t n = 0, i;
+	unsigned long start, end, kib;
+	int found = 0, ret = 0;
+
+	for (i = 0; i < size; i += HUGE_PAGE_SIZE)
+		data[i] = 0;
+
+	if (!(f = fopen("/proc/self/smaps", "r")))
+		return 0;
+
+	while (getline(&line, &n, f) > 0) {
+		/* Every mapping starts with its address range. */
+		if (sscanf(line, "%lx-%lx", &start, &end) == 2) {
+			if (found)
+				break;
+
+			found = start <= (uintptr_t)data && (uintptr_t)data < end;
+			continue;
+		}
+
+		if (found && sscanf(line, "AnonHugePages: %lu kB", &kib) == 1) {
+			ret = kib * KIB >= size;
+			break;
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return ret;
+}
+#endif
+
+/* Tries to map the data eviction buffer using huge pages, such that sweeping
+ * it does not cause any TLB misses and page table lookups of its own. First
+ * the huge pages reserved through hugetlbfs are tried. Otherwise the buffer is
+ * aligned to the huge page size and transparent huge pages are requested. As
+ * the kernel may not honour that request, the buffer is only used if it turns
+ * out to be backed by huge pages.
+ */
+static char *map_huge_pages(size_t size, int *flags)
+{
+	char *data;
+#if defined(MADV_HUGEPAGE) || defined(MAP_ALIGNED_SUPER)
+	char *aligned;
+	size_t head;
+#endif
+
+#if defined(MAP_HUGETLB)
+	if ((data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0)) != MAP_FAILED) {
+		*flags |= CACHE_HUGETLB;
+		return data;
+	}
+#endif
+
+#if defined(MAP_ALIGNED_SUPER)
+	if ((data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_ANONYMOUS | MAP_PRIVATE | MAP_ALIGNED_SUPER, -1, 0)) !=
+		MAP_FAILED) {
+		if (check_huge_pages(data, size)) {
+			*flags |= CACHE_THP;
+			return data;
+		}
+
+		munmap(data, size);
+	}
+#elif defined(MADV_HUGEPAGE)
+	if ((data = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+		MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0)) == MAP_FAILED)
+		return NULL;
+
+	aligned = (char *)(((uintptr_t)data + HUGE_PAGE_SIZE - 1) &
+		~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+	head = aligned - data;
+
+	if (head)
+		munmap(data, head);
+
+	munmap(aligned + size, HUGE_PAGE_SIZE - head);
+
+	if (madvise(aligned, size, MADV_HUGEPAGE) == 0 &&
+		check_huge_pages(aligned, size)) {
+		*flags |= CACHE_THP;
+		return aligned;
+	}
+
+	munmap(aligned, size);
+#endif
+
+	(void)size;
+	(void)flags;
+	(void)data;
+
+	return NULL;
+}
+
+static void del_tlb(struct cache *cache)
+{
+	if (cache->tlb_map.nranges)
+		unmap_sparse(&cache->tlb_map);
+	else if (cache->tlb != cache->data)
+		munmap(cache->tlb, cache->tlb_size);
+}
+
+/* Allocates the eviction buffer. By default a single buffer is used to evict
+ * both the data caches and the TLBs and page structure caches. If huge pages
+ * are requested and available, the data eviction buffer is backed by huge
+ * pages instead, and a separate buffer of small pages is used for the TLBs and
+ * page structure caches. The same split is used for a sparse buffer, of which
+ * only the pages needed to evict the TLBs and page structure caches are
+ * mapped. The target address applies to the TLB eviction buffer if split.
+ */
 struct cache *new_cache(struct page_format *fmt, void *target,
-	size_t cache_size, size_t line_size)
+	size_t cache_size, size_t line_size, int cache_flags)
 {
 	struct cache *cache;
 	struct page_level *level;
 	size_t stride = 0;
+	size_t tlb_size = 0;
 	size_t i;
 	unsigned flags = MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE;
+	int split = !!(cache_flags & CACHE_SPARSE);
 
 	if (target)
 		flags |= MAP_FIXED;
 
-	if (!(cache = malloc(sizeof *cache)))
+	if (!(cache = calloc(1, sizeof *cache)))
 		return NULL;
 
 	cache->fmt = fmt;
 	cache->cache_size = cache_size;
 	cache->line_size = line_size;
+	cache->evict_mode = EVICT_LINEAR;
 
-	// calculate the buffer size needed to evict this cache
-	cache->size = cache_size;
-
+	// calculate the buffer size needed to evict the TLBs
 	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
 		stride = max(level->page_size, level->table_size);
-		cache->size = max(cache->size, level->ncache_entries * stride);
+		tlb_size = max(tlb_size, level->ncache_entries * stride);
+	}
+
+	if (cache_flags & CACHE_HUGEPAGES) {
+		cache->size = (cache_size + HUGE_PAGE_SIZE - 1) &
+			~(HUGE_PAGE_SIZE - 1);
+
+		if ((cache->data = map_huge_pages(cache->size, &cache->flags)))
+			split = 1;
 	}
 
-	if ((cache->data = mmap(target, cache->size, PROT_READ | PROT_WRITE, flags,
-		-1, 0)) == MAP_FAILED) {
-		dperror();
-		goto err_free_cache;
+	if (!cache->data) {
+		// calculate the buffer size needed to evict this cache
+		cache->size = split ? cache_size : max(cache_size, tlb_size);
+
+		if ((cache->data = mmap(split ? NULL : target, cache->size,
+			PROT_READ | PROT_WRITE, split ? flags & ~MAP_FIXED : flags,
+			-1, 0)) == MAP_FAILED) {
+			dperror();
+			goto err_free_cache;
+		}
+	}
+
+	if (!split) {
+		cache->tlb = cache->data;
+		cache->tlb_size = cache->size;
+	} else if (cache_flags & CACHE_SPARSE) {
+		if (map_sparse_tlb(cache, target) < 0) {
+			dprintf("unable to map the sparse TLB eviction set.\n");
+			goto err_free_data;
+		}
+	} else {
+		cache->tlb_size = max(tlb_size, 1);
+
+		if ((cache->tlb = mmap(target, cache->tlb_size,
+			PROT_READ | PROT_WRITE, flags, -1, 0)) == MAP_FAILED) {
+			dperror();
+			goto err_free_data;
+		}
 	}
 
+#if defined(MADV_NOHUGEPAGE)
+	if (split)
+		madvise(cache->tlb, cache->tlb_size, MADV_NOHUGEPAGE);
+#endif
+
+	if (build_evict_plans(cache) < 0)
+		goto err_free_tlb;
+
 	return cache;
 
+err_free_tlb:
+	del_tlb(cache);
+err_free_data:
+	munmap(cache->data, cache->size);
 err_free_cache:
 	free(cache);
 	return NULL;
@@ -60,6 +255,9 @@ err_free_cache:
 
 void del_cache(struct cache *cache)
 {
+	del_evict_plans(cache);
+	clear_evict_sets(cache);
+	del_tlb(cache);
 	munmap(cache->data, cache->size);
 	free(cache);
 }
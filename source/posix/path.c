@@ -9,6 +9,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -64,3 +65,36 @@ err_free_fpath:
 	free(fpath);
 	return ret;
 }
+
+/* Maps the whole file at the given path read-only and stores its size. */
+void *map_file(size_t *size, const char *path)
+{
+	struct stat st;
+	void *data;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+
+	if (fstat(fd, &st) < 0 || !st.st_size)
+		goto err_close;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+	if (data == MAP_FAILED)
+		goto err_close;
+
+	close(fd);
+	*size = st.st_size;
+
+	return data;
+
+err_close:
+	close(fd);
+	return NULL;
+}
+
+void unmap_file(void *data, size_t size)
+{
+	munmap(data, size);
+}
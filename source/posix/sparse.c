@@ -0,0 +1,69 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "sparse.h"
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif /* MAP_NORESERVE */
+
+size_t get_map_granularity(void)
+{
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+/* Estimates the top of the user address space from the address of the
+ * stack, which is located near the top.
+ */
+uintptr_t get_va_limit(void)
+{
+	uintptr_t addr = (uintptr_t)__builtin_frame_address(0);
+	unsigned nbits = 0;
+
+	while (nbits < sizeof addr * CHAR_BIT && (addr >> nbits))
+		++nbits;
+
+	if (nbits >= sizeof addr * CHAR_BIT)
+		return UINTPTR_MAX;
+
+	return (uintptr_t)1 << nbits;
+}
+
+/* Maps the given range without replacing any existing mappings. Kernels that
+ * do not support MAP_FIXED_NOREPLACE treat the address as a hint, so the
+ * returned address has to be checked either way.
+ */
+int map_fixed(void *addr, size_t len)
+{
+	unsigned flags = MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE;
+	void *p;
+
+#if defined(MAP_FIXED_NOREPLACE)
+	flags |= MAP_FIXED_NOREPLACE;
+#endif
+
+	if ((p = mmap(addr, len, PROT_READ | PROT_WRITE, flags, -1, 0)) ==
+		MAP_FAILED)
+		return -1;
+
+	if (p != addr) {
+		munmap(p, len);
+		return -1;
+	}
+
+	return 0;
+}
+
+void unmap_fixed(void *addr, size_t len)
+{
+	munmap(addr, len);
+}
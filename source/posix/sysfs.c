@@ -7,6 +7,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "thread.h"
+
 /* Checks if transparent hugepages is enabled or disabled. */
 int check_transparent_hugepages(void)
 {
@@ -33,3 +35,121 @@ err_close:
 	return ret;
 }
 
+/* Returns the first of the SMT siblings of the given CPU, which identifies
+ * its physical core, or the CPU itself if the topology is unknown.
+ */
+size_t get_core_cpu(size_t cpu)
+{
+	FILE *f;
+	char path[128];
+	char *end, *line = NULL;
+	size_t n = 0;
+	size_t ret = cpu;
+	unsigned long first;
+
+	snprintf(path, sizeof path,
+		"/sys/devices/system/cpu/cpu%zu/topology/thread_siblings_list", cpu);
+
+	if (!(f = fopen(path, "r")))
+		return cpu;
+
+	if (getline(&line, &n, f) == -1)
+		goto err_free_line;
+
+	first = strtoul(line, &end, 10);
+
+	if (end != line)
+		ret = first;
+
+err_free_line:
+	free(line);
+	fclose(f);
+	return ret;
+}
+
+/* Returns the CPUs numbered 0 up to the number of CPUs, for when the online
+ * CPUs cannot be read.
+ */
+static size_t *get_cpu_range(size_t *ncpus)
+{
+	size_t *cpus;
+	size_t i, n = get_cpu_count();
+
+	if (!(cpus = malloc(n * sizeof *cpus)))
+		return NULL;
+
+	for (i = 0; i < n; ++i)
+		cpus[i] = i;
+
+	*ncpus = n;
+
+	return cpus;
+}
+
+/* Returns the ids of the online CPUs in ascending order and stores their
+ * number. As CPUs can be offline, these need not be numbered 0 up to the
+ * number of CPUs. Falls back to that numbering if the online CPUs are
+ * unknown. Returns NULL on failure.
+ */
+size_t *get_online_cpus(size_t *ncpus)
+{
+	FILE *f;
+	char *p, *end, *line = NULL;
+	size_t *cpus = NULL, *new_cpus;
+	size_t n = 0, cap = 0, len = 0;
+	unsigned long first, last;
+
+	if (!(f = fopen("/sys/devices/system/cpu/online", "r")))
+		return get_cpu_range(ncpus);
+
+	if (getline(&line, &len, f) == -1)
+		goto err_free_line;
+
+	/* The list holds single CPUs and ranges of CPUs, e.g. 0-3,8,10-11. */
+	for (p = line;; p = end + 1) {
+		first = strtoul(p, &end, 10);
+
+		if (end == p)
+			goto err_free_cpus;
+
+		last = first;
+
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+
+			if (end == p || last < first)
+				goto err_free_cpus;
+		}
+
+		for (; first <= last; ++first) {
+			if (n == cap) {
+				cap = cap ? 2 * cap : 64;
+
+				if (!(new_cpus = realloc(cpus, cap * sizeof *cpus)))
+					goto err_free_cpus;
+
+				cpus = new_cpus;
+			}
+
+			cpus[n++] = first;
+		}
+
+		if (*end != ',')
+			break;
+	}
+
+	free(line);
+	fclose(f);
+
+	*ncpus = n;
+
+	return cpus;
+
+err_free_cpus:
+	free(cpus);
+err_free_line:
+	free(line);
+	fclose(f);
+	return get_cpu_range(ncpus);
+}
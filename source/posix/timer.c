@@ -0,0 +1,30 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "timer.h"
+
+#if defined(CLOCK_MONOTONIC_RAW)
+#define TIMER_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define TIMER_CLOCK CLOCK_MONOTONIC
+#endif
+
+static uint64_t read_monotonic(void)
+{
+	struct timespec ts;
+
+	clock_gettime(TIMER_CLOCK, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Uses the monotonic clock of the system in nanoseconds. */
+struct timer monotonic_timer = {
+	.name = "monotonic",
+	.read = read_monotonic,
+};
@@ -10,18 +10,26 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <pthread.h>
-
+#include "aggregate.h"
 #include "cache.h"
+#include "capture.h"
+#include "joint.h"
 #include "paging.h"
 #include "profile.h"
+#include "record.h"
 #include "shuffle.h"
 #include "solver.h"
+#include "timer.h"
 
 #define PRIxPTR_WIDTH ((int)(2 * sizeof(uintptr_t)))
 
-static pthread_t timer_thread;
-volatile cycles_t timer_cycles;
+_Thread_local struct profile_stats profile_stats;
+
+/* Used until the profiler has been calibrated. */
+struct profile_model profile_model = {
+	.bound = 1000,
+	.max_retries = 64,
+};
 
 static int cmp_uint64(const void *lhs_, const void *rhs_)
 {
@@ -62,136 +70,867 @@ static FILE *fopenf(const char *fname, const char *mode, ...)
 	return f;
 }
 
-static void *increment_cycles(void *data)
+int init_profiler(int timer)
 {
-	(void)data;
+	return init_timer(timer);
+}
 
-	for (;;)
-		++timer_cycles;
+uint64_t profile_access(volatile char *p)
+{
+	return correct_timing(time_access(p));
+}
 
-	return NULL;
+int get_serialize_mode(const char *name)
+{
+	int mode;
+
+	for (mode = 0; mode < SERIALIZE_NMODES; ++mode) {
+		if (strcmp(serialize_modes[mode], name) == 0)
+			return mode;
+	}
+
+	return -1;
 }
 
-int init_profiler(void)
+const char *get_serialize_mode_name(int mode)
 {
-	timer_cycles = 0;
+	if (mode < 0 || mode >= SERIALIZE_NMODES)
+		return NULL;
 
-	return pthread_create(&timer_thread, NULL, increment_cycles, NULL);
+	return serialize_modes[mode];
 }
 
-uint64_t profile_access(volatile char *p)
+void list_serialize_modes(FILE *f)
 {
-	uint64_t past, now;
+	int mode;
 
-	data_barrier();
-	code_barrier();
-	past = rdtsc();
-	data_barrier();
+	for (mode = 0; mode < SERIALIZE_NMODES; ++mode)
+		fprintf(f, "%s ", serialize_modes[mode]);
+}
+
+int set_serialize_mode(int mode)
+{
+	if (mode < 0 || mode >= SERIALIZE_NMODES)
+		return -1;
 
-	*p = 0x5A;
-	
-	data_barrier();
-	now = rdtsc();
-	code_barrier();
-	data_barrier();
+	serialize_mode = mode;
 
-	return now - past;
+	return 0;
 }
 
-void evict_cache_line(struct cache *cache, size_t table_size,
-	size_t cache_line, size_t page_level)
+/* Measures the cost and the spread of an empty measurement for every
+ * serialization mode, as well as the latency of a cache hit and of a page
+ * table walk after evicting the last page level. A mode is valid if the gap
+ * between the two is at least half of the gap seen with the first mode,
+ * which fully serializes, as a weaker mode lets the timed access slip out of
+ * the measurement. Returns the cheapest valid mode and leaves it selected.
+ */
+int bench_serialize_modes(struct serialize_bench *results,
+	struct cache *cache, size_t nsamples, volatile char *target)
 {
+	struct serialize_bench *result;
 	struct page_format *fmt = cache->fmt;
-	struct page_level *level;
-	volatile char *p = cache->data + cache_line * cache->line_size;
-	size_t stride = 0;
-	size_t i, j;
-	
-	/* Flush the given cache line from the data cache for every page table. */
-	for (; p < cache->data + cache->cache_size; p += table_size) {
+	size_t n = fmt->nlevels - 1;
+	size_t ncache_lines = fmt->levels[n].table_size / cache->line_size;
+	uint64_t *costs, *hits, *misses;
+	uint64_t gap = 0;
+	volatile char *p;
+	size_t cache_line;
+	size_t i;
+	int mode, best = -1;
+	int ret = -1;
+
+	if (!ncache_lines || !nsamples)
+		return -1;
+
+	if (!(costs = malloc(nsamples * sizeof *costs)))
+		return -1;
+
+	if (!(hits = malloc(nsamples * sizeof *hits)))
+		goto err_free_costs;
+
+	if (!(misses = malloc(nsamples * sizeof *misses)))
+		goto err_free_hits;
+
+	for (mode = 0, result = results; mode < SERIALIZE_NMODES; ++mode,
+		++result) {
+		set_serialize_mode(mode);
+
+		for (i = 0; i < nsamples; ++i) {
+			costs[i] = time_access(NULL);
+
+			cache_line = rand() % ncache_lines;
+			p = target + cache_line * cache->line_size;
+
+			*p = 0x5A;
+			hits[i] = profile_access(p);
+
+			evict_cache_line(cache, cache_line, n);
+			misses[i] = profile_access(p);
+		}
+
+		qsort(costs, nsamples, sizeof *costs, cmp_uint64);
+		qsort(hits, nsamples, sizeof *hits, cmp_uint64);
+		qsort(misses, nsamples, sizeof *misses, cmp_uint64);
+
+		result->cost = costs[nsamples / 2];
+		result->spread = costs[3 * nsamples / 4] - costs[nsamples / 4];
+		result->hit = hits[nsamples / 2];
+		result->miss = misses[nsamples / 2];
+
+		if (!mode)
+			gap = result->miss - min(result->hit, result->miss);
+
+		result->valid = (result->miss > result->hit) &&
+			(result->miss - result->hit >= gap / 2);
+
+		if (result->valid && (best < 0 ||
+			result->cost < results[best].cost))
+			best = mode;
+	}
+
+	ret = max(best, 0);
+	set_serialize_mode(ret);
+
+	free(misses);
+err_free_hits:
+	free(hits);
+err_free_costs:
+	free(costs);
+	return ret;
+}
+
+/* The largest number of times a sample is retaken, even if outliers are
+ * common.
+ */
+#define MAX_RETRIES 64
+
+/* Measures the median cost of an empty measurement, which is subtracted from
+ * all subsequent timings. Then builds the latency distribution of cache hits
+ * and of page table walks that miss the caches, TLBs and page structure
+ * caches, using the eviction buffer of the last page level. The outlier bound
+ * is placed at the far-out fence of the misses (the third quartile plus three
+ * times the interquartile range), but never below twice the median miss. The
+ * retry budget is chosen such that a sample has less than a one in a million
+ * chance of exceeding the bound on every attempt, given the outlier rate of
+ * the calibration.
+ */
+int calibrate_profiler(struct cache *cache, size_t nsamples,
+	volatile char *target)
+{
+	struct page_format *fmt = cache->fmt;
+	size_t n = fmt->nlevels - 1;
+	size_t ncache_lines = fmt->levels[n].table_size / cache->line_size;
+	uint64_t *hits, *misses;
+	uint64_t q1, q3;
+	volatile char *p;
+	size_t cache_line;
+	size_t i, noutliers;
+	double chance;
+
+	if (!ncache_lines || !nsamples)
+		return -1;
+
+	if (!(hits = malloc(nsamples * sizeof *hits)))
+		return -1;
+
+	if (!(misses = malloc(nsamples * sizeof *misses))) {
+		free(hits);
+		return -1;
+	}
+
+	for (i = 0; i < nsamples; ++i)
+		hits[i] = time_access(NULL);
+
+	qsort(hits, nsamples, sizeof *hits, cmp_uint64);
+	profile_model.baseline = hits[nsamples / 2];
+
+	for (i = 0; i < nsamples; ++i) {
+		cache_line = rand() % ncache_lines;
+		p = target + cache_line * cache->line_size;
+
 		*p = 0x5A;
+		hits[i] = profile_access(p);
+
+		evict_cache_line(cache, cache_line, n);
+		misses[i] = profile_access(p);
 	}
 
-	/* Flush the TLBs and page structure caches. */
-	for (j = 0, level = fmt->levels; j <= page_level; ++level, ++j) {
-		stride = max(level->page_size, table_size);
-		p = cache->data + cache_line * cache->line_size;
+	qsort(hits, nsamples, sizeof *hits, cmp_uint64);
+	qsort(misses, nsamples, sizeof *misses, cmp_uint64);
 
-		for (i = 0; i < level->ncache_entries; ++i) {
-			*p = 0x5A;
-			p += stride;
+	q1 = misses[nsamples / 4];
+	q3 = misses[3 * nsamples / 4];
+
+	profile_model.hit = hits[nsamples / 2];
+	profile_model.miss = max(profile_model.hit, misses[nsamples / 2]);
+	/* Keep the bound above zero for timers that are too coarse to tell
+	 * any of the accesses apart.
+	 */
+	profile_model.bound = max(q3 + 3 * (q3 - q1),
+		2 * profile_model.miss) + 1;
+
+	for (i = 0, noutliers = 0; i < nsamples; ++i)
+		noutliers += (misses[i] >= profile_model.bound);
+
+	profile_model.outliers = (double)noutliers / nsamples;
+	profile_model.max_retries = 1;
+
+	for (chance = profile_model.outliers; chance > 1e-6 &&
+		profile_model.max_retries < MAX_RETRIES;
+		chance *= profile_model.outliers)
+		++profile_model.max_retries;
+
+	free(misses);
+	free(hits);
+
+	return 0;
+}
+
+/* Touches the full offsets of an eviction plan that does not fit in 32 bits,
+ * in the same order as evict_cache_line().
+ */
+static void evict_wide_offsets(struct evict_plan *plan, volatile char *p,
+	volatile char *q, int reverse)
+{
+	size_t *offset = plan->wide_offsets;
+	size_t *split = offset + plan->ndata;
+	size_t *end = offset + plan->noffsets;
+
+	if (reverse) {
+		while (end > split) {
+			q[*--end] = 0x5A;
+		}
+
+		while (end > offset) {
+			p[*--end] = 0x5A;
+		}
+	} else {
+		for (; offset < split; ++offset) {
+			p[*offset] = 0x5A;
+		}
+
+		for (; offset < end; ++offset) {
+			q[*offset] = 0x5A;
+		}
+	}
+}
+
+/* Flushes the given cache line from the data cache for every page table as
+ * well as the TLBs and page structure caches by touching every offset in the
+ * precompiled eviction plan of the page level, in the order given by the
+ * eviction mode of the cache.
+ */
+void evict_cache_line(struct cache *cache, size_t cache_line,
+	size_t page_level)
+{
+	struct evict_plan *plan = cache->plans + page_level;
+	volatile char *p = cache->data + cache_line * cache->line_size;
+	volatile char *q = cache->tlb + cache_line * cache->line_size;
+	void *volatile *r;
+	uint32_t *offset = plan->offsets;
+	uint32_t *split = offset + plan->ndata;
+	uint32_t *end = offset + plan->noffsets;
+	unsigned shift = plan->shift;
+	int reverse;
+
+	if (cache->evict_mode == EVICT_CHASE) {
+		for (r = plan->chains[cache_line]; r; r = *r);
+
+		return;
+	}
+
+	reverse = (cache->evict_mode == EVICT_REVERSE) ||
+		(cache->evict_mode == EVICT_ZIGZAG && (cache->zigzag ^= 1));
+
+	if (plan->wide_offsets) {
+		evict_wide_offsets(plan, p, q, reverse);
+		return;
+	}
+
+	if (reverse) {
+		while (end > split) {
+			q[(size_t)*--end << shift] = 0x5A;
+		}
+
+		while (end > offset) {
+			p[(size_t)*--end << shift] = 0x5A;
+		}
+	} else {
+		for (; offset < split; ++offset) {
+			p[(size_t)*offset << shift] = 0x5A;
+		}
+
+		for (; offset < end; ++offset) {
+			q[(size_t)*offset << shift] = 0x5A;
 		}
 	}
 }
 
 static void profile_cache_lines(uint64_t *timings, struct cache *cache,
-	struct page_level *level, size_t page_level, size_t *cache_lines,
-	size_t ncache_lines, size_t nrounds, volatile char *page)
+	size_t page_level, size_t *cache_lines, size_t ncache_lines,
+	size_t nrounds, volatile char *page)
 {
 	volatile char *p;
-	uint64_t timing;
+	uint64_t *samples;
+	uint64_t timing, best;
 	size_t cache_line;
-	size_t i, j;
+	size_t i, j, k;
 
 	for (i = 0; i < ncache_lines; ++i) {
 		cache_line = cache_lines[i];
 		p = page + cache_line * cache->line_size;
 
+		samples = timings + cache_line * nrounds;
+		profile_rounds(samples, cache, cache_line, page_level, nrounds, p);
+
+		/* Retake the outliers of the batch. */
 		for (j = 0; j < nrounds; ++j) {
-			timing = UINT64_MAX;
+			timing = best = samples[j];
+			capture_timing(timing, cache_line, 0);
 
-			while (timing >= 1000) {
-				evict_cache_line(cache, level->table_size, cache_line, page_level);
+			for (k = 0; timing >= profile_model.bound &&
+				k < profile_model.max_retries; ++k) {
+				evict_cache_line(cache, cache_line, page_level);
 				timing = profile_access(p);
+				best = min(best, timing);
+				capture_timing(timing, cache_line, CAPTURE_RETRY);
 			}
 
-			timings[cache_line * nrounds + j] = timing;
+			if (timing >= profile_model.bound) {
+				++profile_stats.nexhausted;
+				timing = best;
+			}
+
+			profile_stats.nretries += k;
+			profile_stats.max_retries = max(profile_stats.max_retries, k);
+			samples[j] = timing;
 		}
 	}
+
+	profile_stats.nsamples += ncache_lines * nrounds;
 }
 
-void profile_page_table(uint64_t *timings, struct cache *cache,
-	struct page_level *level, size_t n, size_t ncache_lines, size_t nrounds,
-	volatile char *target, size_t stride)
+/* Profiles the pages of the page level and stores the aggregated timings of
+ * every page, as well as the samples of every round if samples is given. If a
+ * solver state is given, every page is also filtered,
+ * normalised and fed to the solver, and profiling stops as soon as the solver
+ * is done. Returns the number of pages profiled.
+ */
+size_t profile_page_table(uint64_t *timings, uint32_t *samples,
+	struct cache *cache, struct page_level *level, size_t n,
+	size_t ncache_lines, size_t nrounds, volatile char *target, size_t stride,
+	struct solver_state *state)
 {
 	volatile char *page;
 	size_t *cache_lines;
 	uint64_t *line_timings;
+	uint64_t *filtered = NULL;
+	double *ntimings = NULL;
 	uint64_t timing;
-	size_t i, j;
+	size_t npages_per_line = cache->line_size / level->entry_size;
+	size_t i, j = 0, k;
 
 	if (!(line_timings = malloc(ncache_lines * nrounds * sizeof *line_timings)))
-		return;
+		return 0;
 
 	if (!(cache_lines = malloc(ncache_lines * sizeof *cache_lines)))
 		goto err_free_line_timings;
 
+	if (state) {
+		filtered = malloc(ncache_lines * sizeof *filtered);
+		ntimings = malloc(ncache_lines * sizeof *ntimings);
+
+		if (!filtered || !ntimings)
+			goto err_free_row;
+
+		reset_solver_state(state);
+	}
+
 	generate_indicies(cache_lines, ncache_lines);
 
 	page = target;
 
 	for (j = 0; j < level->npages; ++j) {
-		profile_cache_lines(line_timings, cache, level, n,
-			cache_lines, ncache_lines, nrounds, page);
+		set_capture_page(j);
+		profile_cache_lines(line_timings, cache, n, cache_lines,
+			ncache_lines, nrounds, page);
+
+		/* Keep the samples in round order, as aggregating reorders
+		 * them in place.
+		 */
+		for (k = 0; samples && k < ncache_lines * nrounds; ++k) {
+			samples[j * ncache_lines * nrounds + k] =
+				(uint32_t)min(line_timings[k], UINT32_MAX);
+		}
 
 		for (i = 0; i < ncache_lines; ++i) {
-			qsort(line_timings + i * nrounds, nrounds,
-				sizeof *line_timings, cmp_uint64);
-			timing = line_timings[i * nrounds + nrounds / 2];
+			timing = aggregate(line_timings + i * nrounds, nrounds,
+				level->aggregator);
 
 			timings[j * ncache_lines + i] = timing;
 		}
 
 		page += stride;
+
+		if (!state)
+			continue;
+
+		/* The bound of the solver relies on the normalised timings,
+		 * whatever the score mode is.
+		 */
+		memcpy(filtered, timings + j * ncache_lines,
+			ncache_lines * sizeof *filtered);
+		filter_signals(filtered, cache->fmt, target, 1, ncache_lines,
+			npages_per_line, n);
+		normalise_timings(ntimings, filtered, ncache_lines, 1);
+		update_solver_state(state, ntimings);
+
+		if (is_solver_done(state)) {
+			profile_stats.nskipped += level->npages - ++j;
+			break;
+		}
+	}
+
+err_free_row:
+	free(ntimings);
+	free(filtered);
+	free(cache_lines);
+err_free_line_timings:
+	free(line_timings);
+	return j;
+}
+
+/* Runs the given number of rounds over every cache line of every page that
+ * the profiler uses and discards the timings. Returns the number of retries
+ * taken.
+ */
+static size_t profile_all_pages(struct cache *cache, struct page_format *fmt,
+	size_t nrounds, volatile char *target)
+{
+	struct page_level *level;
+	uint64_t *timings;
+	size_t *cache_lines;
+	size_t ncache_lines;
+	size_t nretries = profile_stats.nretries;
+	size_t i, j;
+
+	for (i = 0, level = fmt->levels; i < fmt->nlevels && nrounds; ++i,
+		++level) {
+		ncache_lines = level->table_size / cache->line_size;
+
+		if (!(timings = malloc(ncache_lines * nrounds * sizeof *timings)))
+			continue;
+
+		if (!(cache_lines = malloc(ncache_lines * sizeof *cache_lines))) {
+			free(timings);
+			continue;
+		}
+
+		generate_indicies(cache_lines, ncache_lines);
+
+		for (j = 0; j < level->npages; ++j) {
+			profile_cache_lines(timings, cache, i, cache_lines,
+				ncache_lines, nrounds, target + j * level->page_size);
+		}
+
+		free(cache_lines);
+		free(timings);
+	}
+
+	return profile_stats.nretries - nretries;
+}
+
+/* Warms up the caches, TLBs and branch predictors with the given number of
+ * discarded rounds over every page, such that the measured rounds start in a
+ * steady state. To tell what the warm-up saves, a single round over every page
+ * is timed right before it and right after it: the retries of the former are
+ * those of the first measured round without a warm-up, the retries of the
+ * latter those of the first measured round with one. None of these samples
+ * count towards the statistics of the measured rounds.
+ */
+void warm_up_profiler(struct warm_up_bench *bench, struct cache *cache,
+	struct page_format *fmt, size_t nrounds, volatile char *target)
+{
+	struct profile_stats stats = profile_stats;
+
+	bench->cold = profile_all_pages(cache, fmt, 1, target);
+	profile_all_pages(cache, fmt, nrounds, target);
+	bench->warm = profile_all_pages(cache, fmt, 1, target);
+
+	profile_stats = stats;
+}
+
+/* Measures the cost of evict_cache_line() for every eviction mode, as well
+ * as how often it actually evicts a line of the target. A line counts as
+ * evicted when accessing it takes longer than halfway between the latencies
+ * of a cache hit and a cache miss that calibrate_profiler() measured up front,
+ * such that every mode gets a success rate of its own rather than one
+ * relative to the other modes. Returns -1 if the profiler has not been
+ * calibrated.
+ */
+int bench_evict_modes(struct evict_bench *results, struct cache *cache,
+	size_t n, size_t nsamples, volatile char *target)
+{
+	struct page_level *level = cache->fmt->levels + n;
+	size_t ncache_lines = level->table_size / cache->line_size;
+	uint64_t *costs, *timings, *sorted;
+	uint64_t past, hit = profile_model.hit, miss = profile_model.miss;
+	uint64_t threshold = hit + (miss - hit) / 2;
+	volatile char *p;
+	size_t cache_line;
+	size_t i, nevicted;
+	int old_mode = cache->evict_mode;
+	int mode;
+	int ret = -1;
+
+	if (!ncache_lines || !nsamples || miss <= hit)
+		return -1;
+
+	if (!(costs = malloc(nsamples * EVICT_NMODES * sizeof *costs)))
+		return -1;
+
+	if (!(timings = malloc(nsamples * EVICT_NMODES * sizeof *timings)))
+		goto err_free_costs;
+
+	if (!(sorted = malloc(nsamples * sizeof *sorted)))
+		goto err_free_timings;
+
+	for (mode = 0; mode < EVICT_NMODES; ++mode) {
+		if (set_evict_mode(cache, mode) < 0)
+			goto err_restore_mode;
+
+		for (i = 0; i < nsamples; ++i) {
+			cache_line = rand() % ncache_lines;
+			p = target + cache_line * cache->line_size;
+			*p = 0x5A;
+
+			past = read_timer();
+			evict_cache_line(cache, cache_line, n);
+			costs[mode * nsamples + i] = read_timer() - past;
+			timings[mode * nsamples + i] = profile_access(p);
+		}
+	}
+
+	for (mode = 0; mode < EVICT_NMODES; ++mode) {
+		memcpy(sorted, costs + mode * nsamples, nsamples * sizeof *sorted);
+		qsort(sorted, nsamples, sizeof *sorted, cmp_uint64);
+
+		for (i = 0, nevicted = 0; i < nsamples; ++i)
+			nevicted += (timings[mode * nsamples + i] > threshold);
+
+		results[mode].hit = hit;
+		results[mode].threshold = threshold;
+		results[mode].cost = sorted[nsamples / 2];
+		results[mode].success = 100.0 * nevicted / nsamples;
+	}
+
+	ret = 0;
+
+err_restore_mode:
+	set_evict_mode(cache, old_mode);
+	free(sorted);
+err_free_timings:
+	free(timings);
+err_free_costs:
+	free(costs);
+	return ret;
+}
+
+/* A cell in the MMU-gram that shows a slow page table lookup when the full
+ * eviction buffer is used. The reduced eviction set has to preserve these.
+ */
+struct evict_cell {
+	size_t page;
+	size_t line;
+	uint64_t threshold;
+};
+
+#define MAX_EVICT_CELLS 16
+
+/* Checks whether at least nrequired of the given cells still show slow page
+ * table lookups with the current eviction set of the page level. Stops as
+ * soon as the outcome is known.
+ */
+static int check_evicted_cells(uint64_t *line_timings,
+	struct cache *cache, size_t n, struct evict_cell *cells,
+	size_t ncells, size_t nrequired, size_t nrounds,
+	volatile char *target, size_t stride)
+{
+	struct evict_cell *cell;
+	uint64_t *samples;
+	size_t i, nevicted = 0;
+
+	for (i = 0, cell = cells; i < ncells; ++i, ++cell) {
+		if (nevicted >= nrequired)
+			return 1;
+
+		if (nevicted + (ncells - i) < nrequired)
+			return 0;
+
+		profile_cache_lines(line_timings, cache, n, &cell->line, 1,
+			nrounds, target + cell->page * stride);
+
+		samples = line_timings + cell->line * nrounds;
+
+		if (select_sample(samples, nrounds, nrounds / 2) >= cell->threshold)
+			++nevicted;
+	}
+
+	return nevicted >= nrequired;
+}
+
+/* Reduces the eviction buffer to the minimal set of pages that is needed to
+ * evict the page tables of the given page level using group testing. First
+ * the page level is profiled using the full eviction buffer to find the cells
+ * that show slow page table lookups. Then the pages of the eviction buffer
+ * are split into groups and every group that can be removed without losing
+ * these cells is dropped. The number of groups is doubled whenever no group
+ * can be removed, until the groups consist of single pages. The resulting
+ * eviction set is used by evict_cache_line() for every cache line offset.
+ */
+int find_evict_set(struct cache *cache, struct page_level *level, size_t n,
+	size_t nrounds, volatile char *target)
+{
+	struct evict_cell cells[MAX_EVICT_CELLS], *cell;
+	uint64_t *timings, *line_timings;
+	uint64_t timing, lo, hi;
+	size_t *offsets, *trial;
+	size_t ncache_lines = level->table_size / cache->line_size;
+	size_t stride = level->page_size;
+	size_t noffsets, ntrial, ncells = 0, nrequired;
+	size_t ngroups, group_size, start, end;
+	size_t i, j;
+	int removed;
+	int ret = -1;
+
+	if (!ncache_lines || !level->npages)
+		return -1;
+
+	noffsets = cache->cache_size / level->table_size;
+
+	if (!(timings = malloc(level->npages * ncache_lines * sizeof *timings)))
+		return -1;
+
+	if (!(line_timings = malloc(ncache_lines * nrounds *
+		sizeof *line_timings)))
+		goto err_free_timings;
+
+	if (!(offsets = malloc(noffsets * sizeof *offsets)))
+		goto err_free_line_timings;
+
+	if (!(trial = malloc(noffsets * sizeof *trial)))
+		goto err_free_offsets;
+
+	/* Profile the page level using the full eviction buffer. */
+	set_evict_set(cache, n, NULL, 0);
+	profile_page_table(timings, NULL, cache, level, n, ncache_lines,
+		nrounds, target, stride, NULL);
+
+	for (j = 0; j < level->npages && ncells < MAX_EVICT_CELLS; ++j) {
+		lo = UINT64_MAX;
+		hi = 0;
+
+		for (i = 0; i < ncache_lines; ++i) {
+			timing = timings[j * ncache_lines + i];
+			lo = min(lo, timing);
+			hi = max(hi, timing);
+		}
+
+		if (hi == lo)
+			continue;
+
+		for (i = 0; i < ncache_lines && ncells < MAX_EVICT_CELLS; ++i) {
+			timing = timings[j * ncache_lines + i];
+
+			if (timing - lo < 3 * (hi - lo) / 4)
+				continue;
+
+			cell = cells + ncells++;
+			cell->page = j;
+			cell->line = i;
+			cell->threshold = lo + (hi - lo) / 2;
+		}
 	}
 
+	for (i = 0; i < noffsets; ++i)
+		offsets[i] = i * level->table_size;
+
+	if (set_evict_set(cache, n, offsets, noffsets) < 0)
+		goto err_free_trial;
+
+	/* Not every cell reproduces, so only require most of those that do
+	 * with the full eviction buffer.
+	 */
+	for (i = 0, nrequired = 0; i < ncells; ++i) {
+		nrequired += check_evicted_cells(line_timings, cache, n,
+			cells + i, 1, 1, nrounds, target, stride);
+	}
+
+	if (!(nrequired = nrequired * 3 / 4)) {
+		set_evict_set(cache, n, NULL, 0);
+		goto err_free_trial;
+	}
+
+	for (ngroups = 2;;) {
+		ngroups = min(ngroups, noffsets);
+		group_size = (noffsets + ngroups - 1) / ngroups;
+		removed = 0;
+
+		for (start = 0; start < noffsets;) {
+			end = min(start + group_size, noffsets);
+			ntrial = noffsets - (end - start);
+
+			if (!ntrial)
+				break;
+
+			memcpy(trial, offsets, start * sizeof *trial);
+			memcpy(trial + start, offsets + end,
+				(noffsets - end) * sizeof *trial);
+
+			if (set_evict_set(cache, n, trial, ntrial) < 0)
+				goto err_free_trial;
+
+			if (!check_evicted_cells(line_timings, cache, n, cells,
+				ncells, nrequired, nrounds, target, stride)) {
+				start = end;
+				continue;
+			}
+
+			memcpy(offsets, trial, ntrial * sizeof *offsets);
+			noffsets = ntrial;
+			removed = 1;
+		}
+
+		if (!removed) {
+			if (group_size == 1)
+				break;
+
+			ngroups *= 2;
+		}
+	}
+
+	ret = set_evict_set(cache, n, offsets, noffsets);
+
+err_free_trial:
+	free(trial);
+err_free_offsets:
+	free(offsets);
 err_free_line_timings:
 	free(line_timings);
+err_free_timings:
+	free(timings);
+	return ret;
 }
 
+/* Checks whether the given cache line lies within one line of any of the
+ * given cache lines.
+ */
+static int is_near_line(size_t line, size_t *lines, size_t nlines)
+{
+	size_t i;
+
+	for (i = 0; i < nlines; ++i) {
+		if (line + 1 >= lines[i] && line <= lines[i] + 1)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* As the target is known, profiles only the cache line that holds the page
+ * table entry of every page of the page level, along with the given number
+ * of control lines at random that are not near the page table entries of the
+ * target at any page level. Returns the fraction of pages on which the
+ * expected line is slower than all of its control lines, or -1 on failure.
+ */
+double probe_page_table(struct cache *cache, struct page_level *level,
+	size_t n, size_t ncontrol_lines, size_t nrounds, volatile char *target,
+	size_t stride)
+{
+	struct page_format *fmt = cache->fmt;
+	struct page_level *other;
+	volatile char *page;
+	uint64_t *line_timings;
+	uint64_t timing, expected;
+	size_t *cache_lines;
+	size_t entry_lines[fmt->nlevels];
+	size_t ncache_lines = level->table_size / cache->line_size;
+	size_t nhits = 0;
+	size_t i, j, k, ntries;
+	uintptr_t va;
+
+	if (!level->npages || ncache_lines < 2)
+		return -1.0;
+
+	/* There cannot be more control lines than other lines. */
+	ncontrol_lines = min(ncontrol_lines, ncache_lines - 1);
+
+	if (!(line_timings = malloc(ncache_lines * nrounds *
+		sizeof *line_timings)))
+		return -1.0;
+
+	if (!(cache_lines = malloc((1 + ncontrol_lines) *
+		sizeof *cache_lines))) {
+		free(line_timings);
+		return -1.0;
+	}
+
+	for (j = 0, page = target; j < level->npages; ++j, page += stride) {
+		va = (uintptr_t)page;
+
+		for (i = 0, other = fmt->levels; i < fmt->nlevels; ++i, ++other) {
+			entry_lines[i] = (va / other->page_size) % other->nentries *
+				other->entry_size / cache->line_size;
+		}
+
+		cache_lines[0] = entry_lines[n];
+
+		/* Pick control lines that do not show any signal, giving up on
+		 * page tables too small to have enough of them.
+		 */
+		for (k = 1, ntries = 0; k <= ncontrol_lines &&
+			ntries < 16 * ncache_lines; ++ntries) {
+			i = rand() % ncache_lines;
+
+			if (is_near_line(i, entry_lines, fmt->nlevels) ||
+				is_near_line(i, cache_lines + 1, k - 1))
+				continue;
+
+			cache_lines[k++] = i;
+		}
+
+		set_capture_page(j);
+		profile_cache_lines(line_timings, cache, n, cache_lines, k,
+			nrounds, page);
+
+		expected = aggregate(line_timings + cache_lines[0] * nrounds,
+			nrounds, level->aggregator);
+
+		for (i = 1; i < k; ++i) {
+			timing = aggregate(line_timings + cache_lines[i] * nrounds,
+				nrounds, level->aggregator);
+
+			if (timing >= expected)
+				break;
+		}
+
+		nhits += (k > 1 && i == k);
+	}
+
+	free(cache_lines);
+	free(line_timings);
+
+	return (double)nhits / level->npages;
+}
+
+/* Saves the timings of the page level of the given run as text to
+ * <run>-<name><level>.csv, where every line holds the timings of one page.
+ */
 int save_timings(
 	uint64_t *timings,
 	struct page_level *level,
+	const char *name,
 	size_t n,
 	size_t ncache_lines,
 	size_t run,
@@ -201,7 +940,7 @@ int save_timings(
 	FILE *f;
 	size_t i, j;
 
-	if (!(f = fopenf("%s/%zu-level%zu.csv", "w", output_dir, run, n + 1)))
+	if (!(f = fopenf("%s/%zu-%s%zu.csv", "w", output_dir, run, name, n + 1)))
 		return -1;
 
 	for (j = 0; j < level->npages; ++j) {
@@ -218,6 +957,98 @@ int save_timings(
 	return 0;
 }
 
+/* Loads the timings of the page level of the given run as saved by
+ * save_timings() under the given name. Every line holds the timings of one
+ * page. Returns the timings and stores the number of pages, or returns NULL
+ * if the file does not exist or does not have the given number of cache lines
+ * per page.
+ */
+uint64_t *load_timings(
+	size_t *npages,
+	const char *name,
+	size_t n,
+	size_t ncache_lines,
+	size_t run,
+	const char *input_dir)
+{
+	uint64_t *timings = NULL, *new_timings;
+	size_t i, j = 0, cap = 0;
+	char *line = NULL, *p, *end;
+	size_t len = 0;
+	FILE *f;
+
+	if (!(f = fopenf("%s/%zu-%s%zu.csv", "r", input_dir, run, name, n + 1)))
+		return NULL;
+
+	while (getline(&line, &len, f) > 0) {
+		if (j == cap) {
+			cap = cap ? 2 * cap : 128;
+
+			if (!(new_timings = realloc(timings,
+				cap * ncache_lines * sizeof *timings)))
+				goto err_free_timings;
+
+			timings = new_timings;
+		}
+
+		for (i = 0, p = line; i < ncache_lines; ++i, p = end) {
+			timings[j * ncache_lines + i] = strtoull(p, &end, 10);
+
+			if (end == p)
+				goto err_free_timings;
+		}
+
+		++j;
+	}
+
+	if (!j)
+		goto err_free_timings;
+
+	free(line);
+	fclose(f);
+
+	*npages = j;
+
+	return timings;
+
+err_free_timings:
+	free(timings);
+	free(line);
+	fclose(f);
+	return NULL;
+}
+
+/* Loads the expected slot of every page level of the given run from the
+ * reference file. Returns 0 on success and -1 otherwise.
+ */
+int load_reference(
+	size_t *slots,
+	struct page_format *fmt,
+	size_t run,
+	const char *input_dir)
+{
+	size_t npages_per_line, line, page;
+	size_t i;
+	FILE *f;
+	int ret = -1;
+
+	if (!(f = fopenf("%s/%zu-reference.csv", "r", input_dir, run)))
+		return -1;
+
+	for (i = 0; i < fmt->nlevels; ++i) {
+		if (fscanf(f, "%zu %zu %zu", &npages_per_line, &line, &page) != 3)
+			goto err_close;
+
+		slots[i] = line * npages_per_line + page;
+	}
+
+	ret = 0;
+
+err_close:
+	fclose(f);
+	return ret;
+}
+
 void filter_signals(
 	uint64_t *timings,
 	struct page_format *fmt,
@@ -250,61 +1081,263 @@ void filter_signals(
 	}
 }
 
+/* Measures the cells of the MMU-gram again in which the diagonals of the
+ * given solutions do not all pass through the same cache line, as only these
+ * cells can change the order of the solutions. Every cell keeps the mean of
+ * all its aggregated measurements, with the number of measurements in counts.
+ * Returns the number of samples taken, which is at most the given budget.
+ */
+static size_t refine_page_table(uint64_t *timings, size_t *counts,
+	struct cache *cache, struct page_level *level, size_t n,
+	struct solution *solutions, size_t nsolutions, size_t ncache_lines,
+	size_t npages_per_line, size_t nrounds, volatile char *target,
+	size_t budget)
+{
+	uint64_t *line_timings;
+	uint64_t timing;
+	size_t cache_lines[NSOLUTIONS];
+	size_t row, col, cell;
+	size_t ncols, nsamples = 0;
+	size_t i, j;
+
+	if (!(line_timings = malloc(ncache_lines * nrounds * sizeof *line_timings)))
+		return 0;
+
+	for (row = 0; row < level->npages; ++row) {
+		ncols = 0;
+
+		for (i = 0; i < nsolutions; ++i) {
+			col = (solutions[i].line +
+				(row + solutions[i].page) / npages_per_line) % ncache_lines;
+
+			for (j = 0; j < ncols && cache_lines[j] != col; ++j);
+
+			if (j == ncols)
+				cache_lines[ncols++] = col;
+		}
+
+		if (ncols < 2)
+			continue;
+
+		if (nsamples + ncols * nrounds > budget)
+			break;
+
+		set_capture_page(row);
+		profile_cache_lines(line_timings, cache, n, cache_lines, ncols,
+			nrounds, target + row * level->page_size);
+		nsamples += ncols * nrounds;
+
+		for (i = 0; i < ncols; ++i) {
+			col = cache_lines[i];
+			cell = row * ncache_lines + col;
+			timing = aggregate(line_timings + col * nrounds, nrounds,
+				level->aggregator);
+
+			timings[cell] = (timings[cell] * counts[cell] + timing) /
+				(counts[cell] + 1);
+			++counts[cell];
+		}
+
+		profile_stats.nrefined += ncols;
+	}
+
+	free(line_timings);
+
+	return nsamples;
+}
+
+/* Filters and scores a copy of the timings of the page level and ranks the
+ * solutions. Returns the number of solutions, at most NSOLUTIONS.
+ */
+size_t rank_page_table(struct solution *solutions, uint64_t *filtered,
+	double *ntimings, uint64_t *timings, struct page_format *fmt,
+	struct page_level *level, volatile void *target, size_t n,
+	size_t ncache_lines, size_t npages_per_line)
+{
+	memcpy(filtered, timings, level->npages * ncache_lines * sizeof *filtered);
+	filter_signals(filtered, fmt, target, level->npages, ncache_lines,
+		npages_per_line, n);
+	score_timings(ntimings, filtered, ncache_lines, level->npages);
+
+	return rank_lines(solutions, NSOLUTIONS, ntimings, ncache_lines,
+		level->npages, npages_per_line);
+}
+
+/* Solves the page levels jointly using their unfiltered timings and prints
+ * the resulting virtual address with its probability, or its margin unless
+ * the scores are likelihoods. Returns the number of page levels with the
+ * wrong slot, or a negative value on failure.
+ */
+static int print_joint_solution(double *probability, struct joint_level *joint,
+	struct page_format *fmt, volatile void *target)
+{
+	struct page_level *level;
+	size_t slots[fmt->nlevels];
+	uintptr_t va = 0;
+	size_t i, expected_slot;
+	int slot_errors = 0;
+
+	for (i = 0; i < fmt->nlevels; ++i) {
+		if (!joint[i].timings)
+			return -1;
+	}
+
+	if ((*probability = solve_joint(slots, joint, fmt->nlevels)) < 0)
+		return -1;
+
+	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
+		va += slots[i] * level->page_size;
+		expected_slot = ((uintptr_t)target / level->page_size) % level->nentries;
+		slot_errors += (slots[i] != expected_slot);
+	}
+
+	printf("Joint VA: %p (%s %lf) [%s]\n", (void *)va, get_joint_measure(),
+		*probability, slot_errors ? "!!" : "OK");
+
+	return slot_errors;
+}
+
 unsigned profile_page_tables(
 	unsigned *slot_error_distances,
+	double *margins,
+	int *joint_slot_errors,
+	double *joint_probability,
 	struct cache *cache,
 	struct page_format *fmt,
+	struct profile_policy *policy,
 	size_t nrounds,
 	volatile void *target,
 	size_t run,
 	const char *output_dir)
 {
-	struct page_level *level;
+	struct page_level *level, profiled;
+	struct joint_level joint[fmt->nlevels];
+	struct solver_state *state;
+	struct solution solutions[NSOLUTIONS];
+	struct record_writer writer = { .f = NULL };
+	struct record_level record_level;
 	double *ntimings;
-	uint64_t *timings;
+	uint64_t *timings, *filtered;
+	uint32_t *samples;
+	size_t *counts;
+	char *path;
 	uintptr_t va = 0;
 	size_t slot, page, line;
 	size_t npages_per_line;
 	size_t ncache_lines;
+	size_t ncells;
 	size_t stride = 0;
-	size_t i;
+	size_t i, nsolutions;
+	size_t budget, nsamples, nrefined;
 	size_t expected_slot, expected_page, expected_line;
 	FILE *fsolutions;
 	FILE *freference;
 	unsigned slot_errors = 0;
 
+	*joint_slot_errors = -1;
+
 	if (!(fsolutions = fopenf("%s/%zu-solutions.csv", "w", output_dir, run)))
 		return 0;
 
 	if (!(freference = fopenf("%s/%zu-reference.csv", "w", output_dir, run)))
 		goto err_close_solutions;
 
-	printf("level\tbest line\tbest page\tslot\texpected\tva\n");
+	fprintf(fsolutions, "# npages_per_line line page margin (%s)\n",
+		get_margin_unit());
+
+	if ((record_config.formats & RECORD_BINARY) &&
+		asprintf(&path, "%s/%zu-timings.bin", output_dir, run) >= 0) {
+		if (open_record_writer(&writer, path, fmt->name, nrounds,
+			cache->line_size) < 0)
+			dprintf("unable to create '%s'.\n", path);
+
+		free(path);
+	}
+
+	printf("level\tbest line\tbest page\tslot\texpected\tmargin (%s)\tva\n",
+		get_margin_unit());
+	memset(joint, 0, sizeof joint);
 
 	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
 		stride = level->page_size;
 
 		ncache_lines = level->table_size / cache->line_size;
 		npages_per_line = cache->line_size / level->entry_size;
+		ncells = level->npages * ncache_lines;
+		margins[i] = 0;
+
+		timings = malloc(ncells * sizeof *timings);
+		filtered = malloc(ncells * sizeof *filtered);
+		ntimings = malloc(ncells * sizeof *ntimings);
+		counts = malloc(ncells * sizeof *counts);
+		samples = writer.f ? malloc(ncells * nrounds * sizeof *samples) :
+			NULL;
+		state = NULL;
+
+		if (!timings || !filtered || !ntimings || !counts)
+			goto next_level;
+
+		for (slot = 0; slot < ncells; ++slot)
+			counts[slot] = 1;
+
+		if (policy->error_rate > 0)
+			state = new_solver_state(ncache_lines, npages_per_line,
+				policy->error_rate);
+
+		/* The remainder only looks at the pages that have been profiled
+		 * before the solver was done.
+		 */
+		profiled = *level;
+		arm_capture(run, i, 0);
+		profiled.npages = profile_page_table(timings, samples, cache,
+			level, i, ncache_lines, nrounds, target, stride, state);
+		arm_capture(run, i, CAPTURE_REFINE);
+
+		if (!profiled.npages)
+			goto next_level;
+
+		/* Without a budget, spend as many samples as profiling the page
+		 * level took.
+		 */
+		budget = policy->budget ? policy->budget : ncells * nrounds;
+
+		for (nsamples = 0;; nsamples += nrefined) {
+			nsolutions = rank_page_table(solutions, filtered, ntimings,
+				timings, fmt, &profiled, target, i, ncache_lines,
+				npages_per_line);
+			margins[i] = get_margin(solutions, nsolutions,
+				profiled.npages);
+
+			if (margins[i] >= policy->confidence || nsamples >= budget)
+				break;
+
+			if (!(nrefined = refine_page_table(timings, counts, cache,
+				&profiled, i, solutions, nsolutions, ncache_lines, npages_per_line,
+				nrounds, target, budget - nsamples)))
+				break;
+		}
 
-		if (!(timings = malloc(level->npages * ncache_lines *
-			sizeof *timings)))
-			continue;
+		/* The level files hold the filtered timings that the page
+		 * level was solved from, and the raw level files the timings
+		 * before filtering that replay solves from.
+		 */
+		if (record_config.formats & RECORD_TEXT) {
+			save_timings(filtered, &profiled, "level", i, ncache_lines,
+				run, output_dir);
+			save_timings(timings, &profiled, "raw-level", i,
+				ncache_lines, run, output_dir);
+		}
 
-		if (!(ntimings = malloc(level->npages * ncache_lines *
-			sizeof *ntimings))) {
-			free(timings);
-			continue;
+		if ((joint[i].timings = malloc(ncells * sizeof *joint[i].timings))) {
+			score_timings(joint[i].timings, timings, ncache_lines,
+				profiled.npages);
+			joint[i].ncache_lines = ncache_lines;
+			joint[i].npages = profiled.npages;
+			joint[i].npages_per_line = npages_per_line;
 		}
 
-		profile_page_table(timings, cache, level, i, ncache_lines,
-			nrounds, target, stride);
-		filter_signals(timings, fmt, target, level->npages, ncache_lines,
-			npages_per_line, i);
-		save_timings(timings, level, i, ncache_lines, run, output_dir);
-		normalise_timings(ntimings, timings, ncache_lines, level->npages);
-		solve_lines(&line, &page, ntimings, ncache_lines, level->npages,
-			npages_per_line);
+		line = nsolutions ? solutions[0].line : 0;
+		page = nsolutions ? solutions[0].page : 0;
 
 		/* calculate the slot from the found line and page. */
 		/* use the slot to calculate part of the virtual address. */
@@ -319,21 +1352,54 @@ unsigned profile_page_tables(
 		expected_line = expected_slot / npages_per_line;
 		expected_page = expected_slot % npages_per_line;
 
-		printf("%zu\t%zu\t\t%zu\t\t%zu\t%zu\t\t0x%0*" PRIxPTR " [%s]\n", i + 1, line, page,
-			slot, expected_slot, PRIxPTR_WIDTH, va, slot == expected_slot ? "OK" : "!!");
+		if (writer.f) {
+			record_level = (struct record_level){
+				.page_size = level->page_size,
+				.entry_size = level->entry_size,
+				.nentries = level->nentries,
+				.ncache_lines = ncache_lines,
+				.npages = profiled.npages,
+				.npages_per_line = npages_per_line,
+				.expected_slot = expected_slot,
+			};
+
+			if (write_record_level(&writer, i, &record_level, timings,
+				samples) < 0)
+				dprintf("unable to save the timings of level %zu.\n",
+					i + 1);
+		}
+
+		printf("%zu\t%zu\t\t%zu\t\t%zu\t%zu\t\t%.3lf\t0x%0*" PRIxPTR " [%s]\n", i + 1, line, page,
+			slot, expected_slot, margins[i], PRIxPTR_WIDTH, va, slot == expected_slot ? "OK" : "!!");
 		fflush(stdout);
 
-		fprintf(fsolutions, "%zu %zu %zu\n", npages_per_line, line, page);
+		fprintf(fsolutions, "%zu %zu %zu %lf\n", npages_per_line, line, page,
+			margins[i]);
 		fprintf(freference, "%zu %zu %zu\n", npages_per_line, expected_line, expected_page);
 
+next_level:
+		disarm_capture();
+		del_solver_state(state);
+		free(samples);
+		free(counts);
 		free(ntimings);
+		free(filtered);
 		free(timings);
 	}
 
 	fclose(fsolutions);
 	fclose(freference);
 
+	if (writer.f && close_record_writer(&writer) < 0)
+		dprintf("unable to save the timings of run %zu.\n", run);
+
 	printf("Guessed VA: %p\n", (void *)va);
+	*joint_slot_errors = print_joint_solution(joint_probability, joint, fmt,
+		target);
+
+	for (i = 0; i < fmt->nlevels; ++i)
+		free(joint[i].timings);
+
 	return slot_errors;
 
 err_close_solutions:
@@ -0,0 +1,256 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "path.h"
+#include "record.h"
+
+/* The layout is shared with scripts/plot.py. */
+_Static_assert(sizeof(struct record_level) == 48,
+	"unexpected layout of struct record_level");
+_Static_assert(sizeof(struct record_header) == 352,
+	"unexpected layout of struct record_header");
+
+struct record_config record_config = {
+	.formats = RECORD_TEXT,
+};
+
+static void copy_string(char *dst, const char *src, size_t size)
+{
+	memset(dst, 0, size);
+
+	if (src)
+		strncpy(dst, src, size - 1);
+}
+
+/* Pads the file with zeroes up to the next multiple of RECORD_ALIGN and
+ * returns the offset, or -1 on failure.
+ */
+static long align_record(FILE *f)
+{
+	static const char zeroes[RECORD_ALIGN];
+	long offset;
+
+	if ((offset = ftell(f)) < 0)
+		return -1;
+
+	if (offset % RECORD_ALIGN) {
+		if (fwrite(zeroes, RECORD_ALIGN - offset % RECORD_ALIGN, 1, f) != 1)
+			return -1;
+
+		offset = ftell(f);
+	}
+
+	return offset;
+}
+
+/* Writes the given timings as 32-bit integers, saturating larger ones. */
+static int write_uint32s(FILE *f, uint64_t *values, size_t n)
+{
+	uint32_t buf[256];
+	size_t i, j;
+
+	for (i = 0; i < n; i += j) {
+		for (j = 0; j < 256 && i + j < n; ++j)
+			buf[j] = (uint32_t)min(values[i + j], UINT32_MAX);
+
+		if (fwrite(buf, sizeof *buf, j, f) != j)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Creates the record at the given path and reserves space for the header,
+ * which is written by close_record_writer() once all page levels are known.
+ */
+int open_record_writer(struct record_writer *writer, const char *path,
+	const char *page_format, size_t nrounds, size_t line_size)
+{
+	struct record_header *header = &writer->header;
+
+	memset(header, 0, sizeof *header);
+	memcpy(header->magic, RECORD_MAGIC, sizeof header->magic);
+	header->version = RECORD_VERSION;
+	header->header_size = sizeof *header;
+	header->nrounds = nrounds;
+	header->line_size = line_size;
+	header->flags = record_config.flags;
+	copy_string(header->page_format, page_format, sizeof header->page_format);
+	copy_string(header->timer, record_config.timer, sizeof header->timer);
+	copy_string(header->cpu, record_config.cpu, sizeof header->cpu);
+
+	if (!(writer->f = fopen(path, "wb")))
+		return -1;
+
+	if (fwrite(header, sizeof *header, 1, writer->f) != 1)
+		goto err_close;
+
+	return 0;
+
+err_close:
+	fclose(writer->f);
+	writer->f = NULL;
+	return -1;
+}
+
+/* Appends the timings and optionally the samples of the given page level,
+ * whose geometry is taken from level.
+ */
+int write_record_level(struct record_writer *writer, size_t n,
+	struct record_level *level, uint64_t *timings, uint32_t *samples)
+{
+	struct record_level *dst;
+	size_t ncells = (size_t)level->npages * level->ncache_lines;
+	long offset;
+
+	if (!writer->f || n >= RECORD_MAX_LEVELS)
+		return -1;
+
+	dst = writer->header.levels + n;
+	*dst = *level;
+
+	if ((offset = align_record(writer->f)) < 0)
+		return -1;
+
+	dst->timings = offset;
+
+	if (write_uint32s(writer->f, timings, ncells) < 0)
+		return -1;
+
+	dst->samples = 0;
+
+	if (samples) {
+		if ((offset = align_record(writer->f)) < 0)
+			return -1;
+
+		dst->samples = offset;
+
+		if (fwrite(samples, sizeof *samples, ncells * writer->header.nrounds,
+			writer->f) != ncells * writer->header.nrounds)
+			return -1;
+	}
+
+	writer->header.nlevels = max(writer->header.nlevels, n + 1);
+
+	return 0;
+}
+
+int close_record_writer(struct record_writer *writer)
+{
+	int ret = -1;
+
+	if (!writer->f)
+		return -1;
+
+	if (fseek(writer->f, 0, SEEK_SET) < 0)
+		goto err_close;
+
+	if (fwrite(&writer->header, sizeof writer->header, 1, writer->f) != 1)
+		goto err_close;
+
+	ret = 0;
+
+err_close:
+	if (fclose(writer->f) != 0)
+		ret = -1;
+
+	writer->f = NULL;
+	return ret;
+}
+
+/* Checks that the arrays of every page level lie within the record. */
+static int check_record(struct record_header *header, size_t size)
+{
+	struct record_level *level;
+	uint64_t ncells;
+	size_t i;
+
+	if (size < sizeof *header ||
+		memcmp(header->magic, RECORD_MAGIC, sizeof header->magic) != 0 ||
+		header->version != RECORD_VERSION ||
+		header->header_size != sizeof *header ||
+		header->nlevels > RECORD_MAX_LEVELS)
+		return -1;
+
+	for (i = 0, level = header->levels; i < header->nlevels; ++i, ++level) {
+		ncells = (uint64_t)level->npages * level->ncache_lines;
+
+		if (level->timings % sizeof(uint32_t) ||
+			level->timings > size ||
+			ncells > (size - level->timings) / sizeof(uint32_t))
+			return -1;
+
+		if (level->samples && (level->samples % sizeof(uint32_t) ||
+			level->samples > size || ncells * header->nrounds >
+			(size - level->samples) / sizeof(uint32_t)))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Maps the record at the given path into memory and checks it. */
+struct record *map_record(const char *path)
+{
+	struct record *record;
+
+	if (!(record = malloc(sizeof *record)))
+		return NULL;
+
+	if (!(record->header = map_file(&record->size, path)))
+		goto err_free_record;
+
+	if (check_record(record->header, record->size) < 0)
+		goto err_unmap;
+
+	return record;
+
+err_unmap:
+	unmap_file(record->header, record->size);
+err_free_record:
+	free(record);
+	return NULL;
+}
+
+void unmap_record(struct record *record)
+{
+	if (!record)
+		return;
+
+	unmap_file(record->header, record->size);
+	free(record);
+}
+
+/* Returns a copy of the timings of the given page level of the record, in
+ * the layout that the solvers use.
+ */
+uint64_t *load_record_timings(struct record *record, size_t n)
+{
+	struct record_level *level;
+	uint32_t *src;
+	uint64_t *timings;
+	size_t i, ncells;
+
+	if (n >= record->header->nlevels)
+		return NULL;
+
+	level = record->header->levels + n;
+	ncells = (size_t)level->npages * level->ncache_lines;
+	src = (uint32_t *)((char *)record->header + level->timings);
+
+	if (!ncells || !(timings = malloc(ncells * sizeof *timings)))
+		return NULL;
+
+	for (i = 0; i < ncells; ++i)
+		timings[i] = src[i];
+
+	return timings;
+}
@@ -0,0 +1,461 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "args.h"
+#include "joint.h"
+#include "macros.h"
+#include "paging.h"
+#include "profile.h"
+#include "record.h"
+#include "solver.h"
+#include "thread.h"
+
+/* The outcome of the runs replayed by a single thread. */
+struct replay_stats {
+	size_t nruns;
+	size_t nmissing;
+	size_t nmismatched;
+	size_t nlevels;
+	size_t npages;
+	unsigned nfailures;
+	unsigned nslot_errors;
+	unsigned nslot_error_distances;
+	unsigned njoint_failures;
+	size_t njoint;
+	double total_margin;
+	double total_probability;
+};
+
+/* The reasons that replay_run() fails with: the run could not be loaded, or
+ * it was recorded with a geometry that the replay cannot solve.
+ */
+#define REPLAY_MISSING -1
+#define REPLAY_MISMATCH -2
+
+/* A stride of runs to replay on a thread. */
+struct replay_job {
+	struct replay_stats stats;
+	struct page_format *fmt;
+	const char *input;
+	size_t line_size;
+	size_t first_run;
+	size_t nruns;
+	size_t stride;
+	pthread_t thread;
+	int started;
+};
+
+/* Loads the timings of a page level from the record of the run if there is
+ * one, or from the text files otherwise.
+ */
+static uint64_t *load_level(size_t *npages, struct record *record, size_t n,
+	size_t ncache_lines, size_t run, const char *input)
+{
+	struct record_level *level;
+
+	if (!record)
+		return load_timings(npages, "raw-level", n, ncache_lines, run,
+			input);
+
+	if (n >= record->header->nlevels)
+		return NULL;
+
+	level = record->header->levels + n;
+
+	if (level->ncache_lines != ncache_lines)
+		return NULL;
+
+	*npages = level->npages;
+
+	return load_record_timings(record, n);
+}
+
+/* Loads the expected slots from the record of the run if there is one, or
+ * from the reference file otherwise.
+ */
+static int load_slots(size_t *slots, struct record *record,
+	struct page_format *fmt, size_t run, const char *input)
+{
+	size_t i;
+
+	if (!record)
+		return load_reference(slots, fmt, run, input);
+
+	if (record->header->nlevels < fmt->nlevels)
+		return -1;
+
+	for (i = 0; i < fmt->nlevels; ++i)
+		slots[i] = record->header->levels[i].expected_slot;
+
+	return 0;
+}
+
+static struct record *open_record(size_t run, const char *input)
+{
+	struct record *record;
+	char *path;
+
+	if (asprintf(&path, "%s/%zu-timings.bin", input, run) < 0)
+		return NULL;
+
+	record = map_record(path);
+	free(path);
+
+	return record;
+}
+
+/* Looks up the page format and the line size that the run was recorded with,
+ * as a record is solved with its own geometry rather than the one given on the
+ * command line. Returns NULL if the page format is unknown or does not match
+ * the page levels of the record.
+ */
+static struct page_format *get_record_format(size_t *line_size,
+	struct record *record, size_t run)
+{
+	struct record_header *header = record->header;
+	struct record_level *recorded;
+	struct page_format *fmt;
+	struct page_level *level;
+	char name[sizeof header->page_format + 1];
+	size_t i;
+
+	memcpy(name, header->page_format, sizeof header->page_format);
+	name[sizeof header->page_format] = '\0';
+
+	if (!(fmt = get_page_format(name))) {
+		dprintf("run %zu was recorded with the unknown page format "
+			"'%s'.\n", run, name);
+		return NULL;
+	}
+
+	if (header->nlevels != fmt->nlevels || !header->line_size)
+		goto err_mismatch;
+
+	for (i = 0, level = fmt->levels, recorded = header->levels;
+		i < fmt->nlevels; ++i, ++level, ++recorded) {
+		if (recorded->page_size != level->page_size ||
+			recorded->entry_size != level->entry_size ||
+			recorded->nentries != level->nentries ||
+			recorded->ncache_lines != level->table_size /
+				header->line_size)
+			goto err_mismatch;
+	}
+
+	*line_size = header->line_size;
+
+	return fmt;
+
+err_mismatch:
+	dprintf("run %zu does not match the page format '%s' with %" PRIu32
+		" byte lines.\n", run, name, header->line_size);
+	return NULL;
+}
+
+/* Runs the solver on every page level of a saved run, the same way
+ * profile_page_tables() does after profiling, and adds the outcome to the
+ * statistics. Returns -1 if the run could not be loaded.
+ */
+static int solve_run(struct replay_stats *stats, struct record *record,
+	struct page_format *fmt, size_t line_size, size_t run, const char *input)
+{
+	struct page_level *level, profiled;
+	struct joint_level joint[fmt->nlevels];
+	struct solution solutions[NSOLUTIONS];
+	size_t expected_slots[fmt->nlevels];
+	size_t slots[fmt->nlevels];
+	uint64_t *timings, *filtered;
+	double *ntimings;
+	uintptr_t target = 0;
+	size_t ncache_lines, npages_per_line, ncells, nsolutions;
+	size_t i, slot;
+	unsigned slot_errors = 0, joint_errors = 0;
+	double probability;
+	int ret = -1;
+
+	if (load_slots(expected_slots, record, fmt, run, input) < 0)
+		return -1;
+
+	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level)
+		target += expected_slots[i] * level->page_size;
+
+	memset(joint, 0, sizeof joint);
+
+	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
+		ncache_lines = level->table_size / line_size;
+		npages_per_line = line_size / level->entry_size;
+		profiled = *level;
+
+		if (!(timings = load_level(&profiled.npages, record, i,
+			ncache_lines, run, input)))
+			goto err_free_joint;
+
+		ncells = profiled.npages * ncache_lines;
+		filtered = malloc(ncells * sizeof *filtered);
+		ntimings = malloc(ncells * sizeof *ntimings);
+		joint[i].timings = malloc(ncells * sizeof *joint[i].timings);
+
+		if (!filtered || !ntimings || !joint[i].timings) {
+			free(ntimings);
+			free(filtered);
+			free(timings);
+			goto err_free_joint;
+		}
+
+		nsolutions = rank_page_table(solutions, filtered, ntimings,
+			timings, fmt, &profiled, (void *)target, i, ncache_lines,
+			npages_per_line);
+
+		slot = nsolutions ? solutions[0].line * npages_per_line +
+			solutions[0].page : 0;
+
+		if (slot != expected_slots[i]) {
+			++slot_errors;
+			stats->nslot_error_distances += (unsigned)labs((long)slot -
+				(long)expected_slots[i]);
+		}
+
+		stats->total_margin += get_margin(solutions, nsolutions,
+			profiled.npages);
+		stats->npages += profiled.npages;
+
+		score_timings(joint[i].timings, timings, ncache_lines,
+			profiled.npages);
+		joint[i].ncache_lines = ncache_lines;
+		joint[i].npages = profiled.npages;
+		joint[i].npages_per_line = npages_per_line;
+
+		free(ntimings);
+		free(filtered);
+		free(timings);
+	}
+
+	if ((probability = solve_joint(slots, joint, fmt->nlevels)) >= 0) {
+		for (i = 0; i < fmt->nlevels; ++i)
+			joint_errors += (slots[i] != expected_slots[i]);
+
+		stats->njoint_failures += (joint_errors > 0);
+		stats->total_probability += probability;
+		++stats->njoint;
+	}
+
+	++stats->nruns;
+	stats->nlevels += fmt->nlevels;
+	stats->nfailures += (slot_errors > 0);
+	stats->nslot_errors += slot_errors;
+	ret = 0;
+
+err_free_joint:
+	for (i = 0; i < fmt->nlevels; ++i)
+		free(joint[i].timings);
+
+	return ret;
+}
+
+/* Solves a saved run with the geometry of its record, or with the given page
+ * format and line size if there are only text files. Returns REPLAY_MISSING
+ * if the run could not be loaded and REPLAY_MISMATCH if its record does not
+ * match its page format.
+ */
+static int replay_run(struct replay_stats *stats, struct page_format *fmt,
+	size_t line_size, size_t run, const char *input)
+{
+	struct record *record = open_record(run, input);
+	int ret = REPLAY_MISMATCH;
+
+	if (record && !(fmt = get_record_format(&line_size, record, run)))
+		goto err_unmap_record;
+
+	ret = solve_run(stats, record, fmt, line_size, run, input) < 0 ?
+		REPLAY_MISSING : 0;
+
+err_unmap_record:
+	unmap_record(record);
+	return ret;
+}
+
+static void *replay_runs(void *data)
+{
+	struct replay_job *job = data;
+	size_t run;
+	int ret;
+
+	for (run = job->first_run; run < job->nruns; run += job->stride) {
+		ret = replay_run(&job->stats, job->fmt, job->line_size, run,
+			job->input);
+
+		if (ret == REPLAY_MISMATCH)
+			++job->stats.nmismatched;
+		else if (ret < 0)
+			++job->stats.nmissing;
+	}
+
+	return NULL;
+}
+
+/* Counts the saved runs by looking for their records or reference files. */
+static size_t count_runs(struct page_format *fmt, const char *input)
+{
+	struct record *record;
+	size_t slots[fmt->nlevels];
+	size_t run;
+
+	for (run = 0;; ++run) {
+		if ((record = open_record(run, input))) {
+			unmap_record(record);
+			continue;
+		}
+
+		if (load_reference(slots, fmt, run, input) < 0)
+			break;
+	}
+
+	return run;
+}
+
+static double get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, const char *argv[])
+{
+	struct args args = {
+		.npages = { 128, 128, 128, 128 },
+		.nentries = { SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX },
+		.line_size = 64,
+		.input = "results",
+		.timer_cpu = -1,
+		.serialize = -1,
+	};
+	struct page_format *page_format;
+	struct replay_job *jobs, *job;
+	struct replay_stats stats = { 0 };
+	size_t nlevels;
+	size_t nthreads;
+	size_t i;
+	double start, elapsed;
+
+	if (parse_args(&args, argc, argv) < 0) {
+		show_usage(argv[0]);
+		return -1;
+	}
+
+	set_score_mode(args.score);
+
+	if (!(page_format = get_page_format_from_args(&args))) {
+		dprintf("unknown page format '%s', please use "
+			"--list-page-formats to list all available page "
+			"formats and specify the page format using "
+			"--page-format.\n", args.page_format);
+		return -1;
+	}
+
+	if (!args.nruns && !(args.nruns = count_runs(page_format, args.input))) {
+		dprintf("no runs found in '%s'.\n", args.input);
+		return -1;
+	}
+
+	nthreads = min(args.nthreads ? args.nthreads : get_cpu_count(),
+		args.nruns);
+
+	if (!(jobs = calloc(nthreads, sizeof *jobs))) {
+		dprintf("unable to allocate the replay jobs.\n");
+		return -1;
+	}
+
+	printf("Replaying %zu runs from '%s' on %zu threads (score: %s)\n",
+		args.nruns, args.input, nthreads, get_score_mode_name(args.score));
+
+	start = get_time();
+
+	for (i = 0, job = jobs; i < nthreads; ++i, ++job) {
+		job->fmt = page_format;
+		job->input = args.input;
+		job->line_size = args.line_size;
+		job->first_run = i;
+		job->nruns = args.nruns;
+		job->stride = nthreads;
+
+		/* The calling thread takes the first job. */
+		if (i)
+			job->started = pthread_create(&job->thread, NULL,
+				replay_runs, job) == 0;
+	}
+
+	for (i = 0, job = jobs; i < nthreads; ++i, ++job) {
+		if (!job->started)
+			replay_runs(job);
+	}
+
+	for (i = 0, job = jobs; i < nthreads; ++i, ++job) {
+		if (job->started)
+			pthread_join(job->thread, NULL);
+
+		stats.nruns += job->stats.nruns;
+		stats.nmissing += job->stats.nmissing;
+		stats.nmismatched += job->stats.nmismatched;
+		stats.nlevels += job->stats.nlevels;
+		stats.npages += job->stats.npages;
+		stats.nfailures += job->stats.nfailures;
+		stats.nslot_errors += job->stats.nslot_errors;
+		stats.nslot_error_distances += job->stats.nslot_error_distances;
+		stats.njoint_failures += job->stats.njoint_failures;
+		stats.njoint += job->stats.njoint;
+		stats.total_margin += job->stats.total_margin;
+		stats.total_probability += job->stats.total_probability;
+	}
+
+	elapsed = get_time() - start;
+	free(jobs);
+
+	nlevels = stats.nlevels;
+
+	printf("\n ---- STATISTICS ----\n");
+	printf("Runs: %zu (%zu missing, %zu mismatched)\n", stats.nruns,
+		stats.nmissing, stats.nmismatched);
+	printf("Failures: %u (%lf%%, %zu total)\n",
+		stats.nfailures,
+		stats.nruns ? (double)stats.nfailures / stats.nruns * 100 : 0.0,
+		stats.nruns);
+	printf("Slot errors: %u (%lf%%, %zu total)\n",
+		stats.nslot_errors,
+		nlevels ? (double)stats.nslot_errors / nlevels * 100 : 0.0,
+		nlevels);
+	printf("Total slot error distances: %u (%lf per run)\n",
+		stats.nslot_error_distances,
+		stats.nruns ? (double)stats.nslot_error_distances / stats.nruns :
+			0.0);
+	printf("Joint failures: %u (%lf%%, %zu total, %lf mean %s)\n",
+		stats.njoint_failures,
+		stats.njoint ? (double)stats.njoint_failures / stats.njoint * 100 :
+			0.0,
+		stats.njoint,
+		stats.njoint ? stats.total_probability / stats.njoint : 0.0,
+		get_joint_measure());
+	printf("Mean margin: %lf %s\n",
+		nlevels ? stats.total_margin / nlevels : 0.0, get_margin_unit());
+	printf("Throughput: %lf runs/s, %lf pages/s (%lf s)\n",
+		elapsed > 0 ? stats.nruns / elapsed : 0.0,
+		elapsed > 0 ? stats.npages / elapsed : 0.0,
+		elapsed);
+
+	if (args.page_format)
+		free(args.page_format);
+
+	return 0;
+}
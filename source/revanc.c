@@ -11,6 +11,8 @@
 #include <string.h>
 #include <time.h>
 
+#include <pthread.h>
+
 #include "args.h"
 #include "buffer.h"
 #include "cache.h"
@@ -18,8 +20,10 @@
 #include "profile.h"
 #include "shuffle.h"
 #include "solver.h"
+#include "sparse.h"
 #include "sysfs.h"
 #include "thread.h"
+#include "timer.h"
 #include "macros.h"
 #include "path.h"
 
@@ -28,117 +32,744 @@
 #include <cpuid/cpuid.h>
 #endif
 
-int brute_force_evict_set(struct page_format *fmt, void *evict_target,
-	size_t cache_size, size_t line_size, size_t nrounds, size_t nruns,
-	float threshold, volatile void *target)
+/* Picks the serialization mode unless given and calibrates the profiler
+ * using the first eviction buffer.
+ */
+static int setup_profiler(struct cache *cache, struct args *args,
+	volatile void *target)
 {
+	struct serialize_bench results[SERIALIZE_NMODES];
+
+	if (args->serialize < 0 && (args->serialize = bench_serialize_modes(
+		results, cache, 10 * args->nrounds, target)) < 0) {
+		dprintf("unable to benchmark the serialization modes.\n");
+		return -1;
+	}
+
+	set_serialize_mode(args->serialize);
+
+	if (calibrate_profiler(cache, 10 * args->nrounds, target) < 0) {
+		dprintf("unable to calibrate the profiler.\n");
+		return -1;
+	}
+
+	printf("serialization: %s, hit %" PRIu64 ", miss %" PRIu64
+		", bound %" PRIu64 "\n", get_serialize_mode_name(args->serialize),
+		profile_model.hit, profile_model.miss, profile_model.bound);
+
+	return 0;
+}
+
+/* The success rates on either side of --threshold that the sequential
+ * probability ratio test tells apart, and its error rate unless given with
+ * --sprt-error.
+ */
+#define SPRT_MARGIN 0.1
+#define SPRT_ERROR_RATE 0.05
+
+/* Wald's sequential probability ratio test of whether the success rate of a
+ * candidate lies above the threshold (p1) or below it (p0).
+ */
+struct sprt {
+	double llr;
+	double success_llr, failure_llr;
+	double upper, lower;
+};
+
+static void init_sprt(struct sprt *sprt, float threshold, double error_rate)
+{
+	double p = min(max(threshold / 100.0, 0.0), 1.0);
+	double p0 = max(p - SPRT_MARGIN, 0.01);
+	double p1 = min(p + SPRT_MARGIN, 0.99);
+
+	if (error_rate <= 0.0 || error_rate >= 0.5)
+		error_rate = SPRT_ERROR_RATE;
+
+	sprt->llr = 0.0;
+	sprt->success_llr = log(p1 / p0);
+	sprt->failure_llr = log((1.0 - p1) / (1.0 - p0));
+	sprt->upper = log((1.0 - error_rate) / error_rate);
+	sprt->lower = -sprt->upper;
+}
+
+/* Returns the number of runs that the sequential test takes on average for a
+ * candidate with a success rate where the test leans neither way, which is
+ * where it takes the longest. Wald approximates this as upper * -lower over
+ * the expected square of the log-likelihood ratio of a run. With fewer runs,
+ * the test rarely decides.
+ */
+static size_t get_sprt_runs(float threshold, double error_rate)
+{
+	struct sprt sprt;
+	double p, var;
+
+	init_sprt(&sprt, threshold, error_rate);
+
+	p = -sprt.failure_llr / (sprt.success_llr - sprt.failure_llr);
+	var = p * sprt.success_llr * sprt.success_llr +
+		(1.0 - p) * sprt.failure_llr * sprt.failure_llr;
+
+	return (size_t)ceil(sprt.upper * -sprt.lower / var);
+}
+
+/* Adds the outcome of a run and returns 1 if the candidate passes, 0 if it
+ * fails and -1 if more runs are needed.
+ */
+static int update_sprt(struct sprt *sprt, int success)
+{
+	sprt->llr += success ? sprt->success_llr : sprt->failure_llr;
+
+	if (sprt->llr >= sprt->upper)
+		return 1;
+
+	if (sprt->llr <= sprt->lower)
+		return 0;
+
+	return -1;
+}
+
+/* The fraction of pages on which the line of the target has to stand out
+ * from its control lines for a run to succeed with --control-lines.
+ */
+#define PROBE_RATE 0.5
+
+/* The state to probe the candidates of a page level with on a physical core.
+ * As the TLBs and page structure caches are private to a core, every core has
+ * its own pinned thread, target buffer, eviction buffer that holds up to
+ * capacity cache entries, and copy of the page format to evict with. The
+ * thread probes the page level for the given number of cache entries. When
+ * several probers run at the same time, each prints a candidate as a whole
+ * line once it is decided. The probers still share the LLC, such that their
+ * evictions and timings disturb each other, which is why a single prober is
+ * the default.
+ */
+struct prober {
+	struct page_format fmt;
+	struct buffer *buffer;
+	volatile void *target;
+	void *evict_target;
 	struct cache *cache;
-	struct page_level *level;
-	double *ntimings;
+	size_t capacity;
 	uint64_t *timings;
-	size_t ncache_lines, npages_per_line;
-	size_t stride = 0;
-	size_t slot, page, line;
-	size_t expected_slot;
-	size_t i;
-	size_t mult2, mult3;
+	double *ntimings;
+	char *marks;
+	struct args *args;
+	size_t n;
+	size_t ncache_entries;
+	size_t cpu;
+	int result;
+	int batched;
+	pthread_t thread;
+};
+
+/* The largest number of cache entries that revanc searches for per page level.
+ * Above this, the eviction buffers and their page tables take too much memory
+ * to be set up for every page level.
+ */
+#define MAX_CACHE_ENTRIES 6144
 
-	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
-		if (level->npages == 0)
-			continue;
+/* Returns the last value of the sequence 1, 2, 3, 4, 6, 8, 12, ... that
+ * search_cache_entries() brackets page level n with. This is at most
+ * MAX_CACHE_ENTRIES, and less for page levels with pages so large that the
+ * eviction buffer would not fit in a quarter of the address space.
+ */
+static size_t get_max_cache_entries(struct page_format *fmt, size_t n)
+{
+	struct page_level *level = fmt->levels + n;
+	size_t stride = max(level->page_size, level->table_size);
+	size_t limit = min(MAX_CACHE_ENTRIES, get_va_limit() / 4 / stride);
+	size_t mult2 = 1, mult3 = 3, last = 0;
+
+	while (min(mult2, mult3) <= limit) {
+		if (mult2 < mult3) {
+			last = mult2;
+			mult2 *= 2;
+		} else {
+			last = mult3;
+			mult3 *= 2;
+		}
+	}
 
-		stride = level->page_size;
+	return last;
+}
 
-		ncache_lines = level->table_size / line_size;
-		npages_per_line = line_size / level->entry_size;
+/* Allocates the eviction buffer of the prober for the given number of cache
+ * entries of page level n, the largest that the search probes, and prefaults
+ * it once. Every candidate of the page level then only rebuilds the eviction
+ * plans, which access a prefix of the entries of the buffer.
+ */
+static int reserve_cache_entries(struct prober *prober, size_t n,
+	size_t ncache_entries)
+{
+	struct args *args = prober->args;
+	int cache_flags = (args->evict_hugepages ? CACHE_HUGEPAGES : 0) |
+		(args->sparse ? CACHE_SPARSE : 0);
 
-		expected_slot = ((uintptr_t)target / level->page_size) % level->nentries;
-		slot = SIZE_MAX;
+	prober->capacity = ncache_entries;
+	prober->fmt.levels[n].ncache_entries = prober->capacity;
 
-		if (!(timings = malloc(level->npages * ncache_lines *
-			sizeof *timings)))
-			continue;
+	if (!(prober->cache = new_cache(&prober->fmt, prober->evict_target,
+		args->cache_size, args->line_size, cache_flags))) {
+		dprintf("unable to allocate the eviction set.\n");
+		return -1;
+	}
 
-		if (!(ntimings = malloc(level->npages * ncache_lines *
-			sizeof *ntimings))) {
-			free(timings);
-			continue;
-		}
+	if (set_evict_mode(prober->cache, args->evict_mode) < 0) {
+		dprintf("unable to set up the eviction mode.\n");
+		del_cache(prober->cache);
+		prober->cache = NULL;
+		return -1;
+	}
+
+	prefault_cache(prober->cache);
+
+	return 0;
+}
+
+/* Profiles page level n with an eviction set of the given number of cache
+ * entries for at most --runs runs, stopping as soon as the sequential test
+ * decides. Without a decision the success rate is compared against
+ * --threshold. With --control-lines, a run only times the line of the target
+ * and a few control lines of every page rather than solving the page table.
+ * Unless the output is batched, the progress is shown as the runs are taken.
+ * Returns 1 if the candidate passes, 0 if it fails and -1 on
+ * failure.
+ */
+static int probe_cache_entries(struct prober *prober, size_t n,
+	size_t ncache_entries)
+{
+	struct args *args = prober->args;
+	struct page_format *fmt = &prober->fmt;
+	struct page_level *level = fmt->levels + n;
+	struct cache *cache;
+	struct sprt sprt;
+	volatile void *target = prober->target;
+	uint64_t *timings = prober->timings;
+	double *ntimings = prober->ntimings;
+	size_t ncache_lines = level->table_size / args->line_size;
+	size_t npages_per_line = args->line_size / level->entry_size;
+	size_t expected_slot, slot, page, line;
+	size_t run, success = 0;
+	double rate;
+	int hit, ret = -1;
+
+	expected_slot = ((uintptr_t)target / level->page_size) % level->nentries;
+	expected_slot &= level->slot_mask;
+
+	if (!prober->cache || ncache_entries > prober->capacity)
+		return -1;
+
+	cache = prober->cache;
+	level->ncache_entries = ncache_entries;
+
+	if (build_evict_plans(cache) < 0) {
+		dprintf("unable to build the eviction plans.\n");
+		return -1;
+	}
+
+	init_sprt(&sprt, args->threshold, args->sprt_error);
 
-		mult2 = 1;
-		mult3 = 3;
-		size_t run = 0;
-		size_t success = 0;
-		float rate;
-
-		for (;;) {
-			if (!(cache = new_cache(fmt, evict_target, cache_size,
-				line_size))) {
-				dprintf("unable to allocate the eviction set.\n");
-				free(timings);
-				free(ntimings);
+	if (!prober->batched) {
+		printf("probing %zu [", ncache_entries);
+		fflush(stdout);
+	}
+
+	for (run = 0; run < args->nruns; ++run) {
+		if (args->ncontrol_lines) {
+			if ((rate = probe_page_table(cache, level, n,
+				args->ncontrol_lines, args->nrounds, target,
+				level->page_size)) < 0) {
+				dprintf("unable to probe the page table.\n");
 				return -1;
 			}
 
-			success = 0;
+			hit = rate >= PROBE_RATE;
+		} else {
+			profile_page_table(timings, NULL, cache, level, n,
+				ncache_lines, args->nrounds, target, level->page_size,
+				NULL);
+
+			if (fmt->flags & PAGE_FORMAT_FILTER)
+				filter_signals(timings, fmt, target, level->npages,
+					ncache_lines, npages_per_line, n);
+			score_timings(ntimings, timings, ncache_lines,
+				level->npages);
+			solve_lines(&line, &page, ntimings, ncache_lines,
+				level->npages, npages_per_line);
+
+			slot = (line * npages_per_line + page) & level->slot_mask;
+			hit = fabs((float)slot - expected_slot) <= 1.0;
+		}
+
+		success += hit;
+		prober->marks[run] = hit ? '#' : '.';
 
-			printf("probing %zu [", level->ncache_entries);
+		if (!prober->batched) {
+			putc(prober->marks[run], stdout);
 			fflush(stdout);
+		}
 
-			for (run = 0; run < nruns; ++run) {
-				profile_page_table(timings, cache, level, i, ncache_lines,
-					nrounds, target, stride);
+		if ((ret = update_sprt(&sprt, hit)) >= 0) {
+			++run;
+			break;
+		}
+	}
 
-				if (fmt->flags & PAGE_FORMAT_FILTER)
-					filter_signals(timings, fmt, target, level->npages,
-						ncache_lines, npages_per_line, i);
-				normalise_timings(ntimings, timings, ncache_lines, level->npages);
-				solve_lines(&line, &page, ntimings, ncache_lines, level->npages,
-					npages_per_line);
+	if (ret < 0)
+		ret = 100.0f * success / run >= args->threshold;
 
-				slot = line * npages_per_line + page;
+	if (prober->batched)
+		printf("cpu %zu: probing %zu [%.*s] %s\n", prober->cpu,
+			ncache_entries, (int)run, prober->marks, ret ? "pass" : "fail");
+	else
+		printf("] %s\n", ret ? "pass" : "fail");
 
-				slot &= level->slot_mask;
-				expected_slot &= level->slot_mask;
+	return ret;
+}
 
-				if (fabs((float)slot - expected_slot) <= 1.0) {
-					++success;
-					putc('#', stdout);
-				} else {
-					putc('.', stdout);
-				}
+static void *run_prober(void *data)
+{
+	struct prober *prober = data;
 
-				fflush(stdout);
-			}
+	if (pin_cpu(prober->cpu) != 0) {
+		dprintf("unable to pin the thread to CPU %zu.\n", prober->cpu);
+		prober->result = -1;
+		return NULL;
+	}
 
-			printf("]\n");
-			del_cache(cache);
+	prober->result = probe_cache_entries(prober, prober->n,
+		prober->ncache_entries);
 
-			rate = 100.0f * success / nruns;
+	return NULL;
+}
 
-			if (rate >= threshold) {
-				break;
-			}
+/* Probes page level n for the given number of cache entries on every prober
+ * at the same time. The first prober runs on the calling thread, which is
+ * already pinned, the others on their own pinned threads. Returns -1 if any
+ * of the probers failed.
+ */
+static int run_probers(struct prober *probers, size_t nprobers, size_t n,
+	size_t *ncache_entries)
+{
+	struct prober *prober;
+	int started[nprobers];
+	size_t i;
+	int ret = 0;
+
+	for (i = 0, prober = probers; i < nprobers; ++i, ++prober) {
+		prober->n = n;
+		prober->ncache_entries = ncache_entries[i];
+		prober->result = -1;
+	}
+
+	for (i = 1, prober = probers + 1; i < nprobers; ++i, ++prober) {
+		if (!(started[i] = pthread_create(&prober->thread, NULL,
+			run_prober, prober) == 0))
+			dprintf("unable to start the thread for CPU %zu.\n",
+				prober->cpu);
+	}
+
+	probers->result = probe_cache_entries(probers, n, *ncache_entries);
+
+	for (i = 1, prober = probers + 1; i < nprobers; ++i, ++prober) {
+		if (started[i])
+			pthread_join(prober->thread, NULL);
+	}
 
+	for (i = 0, prober = probers; i < nprobers; ++i, ++prober) {
+		if (prober->result < 0)
+			ret = -1;
+	}
+
+	return ret;
+}
+
+/* Finds the smallest number of cache entries that evicts page level n. The
+ * number of entries is increased along the sequence 1, 2, 3, 4, 6, 8, 12, ...
+ * until a candidate passes, up to the given maximum, after which the bracket
+ * between the last failing and the first passing candidate is narrowed down.
+ * Every step probes one candidate per prober: the next points of the sequence
+ * while bracketing, and points spread evenly across the bracket while
+ * narrowing it down, which bisects it with a single prober. Returns 0 on
+ * failure.
+ */
+static size_t search_cache_entries(struct prober *probers, size_t nprobers,
+	size_t n, size_t max_entries)
+{
+	size_t ncache_entries[nprobers];
+	size_t lo = 0, hi = 0;
+	size_t mult2 = 1, mult3 = 3;
+	size_t i, m;
+
+	while (!hi) {
+		for (m = 0; m < nprobers && min(mult2, mult3) <= max_entries;
+			++m) {
 			if (mult2 < mult3) {
-				level->ncache_entries = mult2;
+				ncache_entries[m] = mult2;
 				mult2 *= 2;
 			} else {
-				level->ncache_entries = mult3;
+				ncache_entries[m] = mult3;
 				mult3 *= 2;
 			}
 		}
 
-		printf("found PL%zu cache entries: %zu\n", (i + 1),
-			level->ncache_entries);
+		if (!m) {
+			dprintf("no candidate up to %zu entries evicts PL%zu.\n",
+				max_entries, n + 1);
+			return 0;
+		}
+
+		if (run_probers(probers, m, n, ncache_entries) < 0)
+			return 0;
+
+		for (i = 0; i < m && !hi; ++i) {
+			if (probers[i].result)
+				hi = ncache_entries[i];
+			else
+				lo = ncache_entries[i];
+		}
+	}
+
+	while (hi - lo > 1) {
+		m = min(nprobers, hi - lo - 1);
+
+		for (i = 0; i < m; ++i)
+			ncache_entries[i] = lo + (hi - lo) * (i + 1) / (m + 1);
+
+		if (run_probers(probers, m, n, ncache_entries) < 0)
+			return 0;
+
+		for (i = 0; i < m; ++i) {
+			if (probers[i].result) {
+				hi = ncache_entries[i];
+				break;
+			}
+
+			lo = ncache_entries[i];
+		}
+	}
+
+	return hi;
+}
+
+/* Probes the number of cache entries found for page level n, as well as one
+ * entry less, on every prober, and reports how many of the cores agree that
+ * the former passes and the latter fails.
+ */
+static int check_agreement(struct prober *probers, size_t nprobers, size_t n,
+	size_t found)
+{
+	size_t ncache_entries[nprobers];
+	size_t npassed = 0, nfailed = 0;
+	size_t i;
+
+	for (i = 0; i < nprobers; ++i)
+		ncache_entries[i] = found;
+
+	if (run_probers(probers, nprobers, n, ncache_entries) < 0)
+		return -1;
+
+	for (i = 0; i < nprobers; ++i)
+		npassed += probers[i].result;
 
-		free(ntimings);
-		free(timings);
+	if (found > 1) {
+		for (i = 0; i < nprobers; ++i)
+			ncache_entries[i] = found - 1;
+
+		if (run_probers(probers, nprobers, n, ncache_entries) < 0)
+			return -1;
+
+		for (i = 0; i < nprobers; ++i)
+			nfailed += !probers[i].result;
+	}
+
+	printf("PL%zu agreement: %zu/%zu cores pass %zu entries", n + 1,
+		npassed, nprobers, found);
+
+	if (found > 1)
+		printf(", %zu/%zu cores fail %zu entries", nfailed, nprobers,
+			found - 1);
+
+	printf("\n");
+
+	return 0;
+}
+
+/* Picks the CPUs to probe on: the given CPU, followed by the first online
+ * SMT sibling of every other physical core, leaving out the core that runs
+ * the counting thread of the thread timer. Returns the number of CPUs picked,
+ * which is at most ncpus.
+ */
+static size_t pick_prober_cpus(size_t *cpus, size_t ncpus, struct args *args)
+{
+	const char *timer = get_timer_name(args->timer);
+	size_t core = get_core_cpu(args->cpu);
+	size_t timer_core = SIZE_MAX;
+	size_t *online, nonline;
+	size_t i, j, cpu, n = 0;
+
+	if (timer && strcmp(timer, "thread") == 0 && args->timer_cpu >= 0)
+		timer_core = get_core_cpu(args->timer_cpu);
+
+	if (ncpus)
+		cpus[n++] = args->cpu;
+
+	if (!(online = get_online_cpus(&nonline)))
+		return n;
+
+	for (i = 0; i < nonline && n < ncpus; ++i) {
+		cpu = get_core_cpu(online[i]);
+
+		if (cpu == core || cpu == timer_core)
+			continue;
+
+		/* The first sibling may be offline, so skip the core if an
+		 * earlier sibling has been picked already.
+		 */
+		for (j = 1; j < n && get_core_cpu(cpus[j]) != cpu; ++j);
+
+		if (j < n)
+			continue;
+
+		cpus[n++] = online[i];
+	}
+
+	free(online);
+
+	return n;
+}
+
+static void del_probers(struct prober *probers, size_t nprobers)
+{
+	struct prober *prober;
+	size_t i;
+
+	for (i = 0, prober = probers; i < nprobers; ++i, ++prober) {
+		if (prober->buffer)
+			del_buffer(prober->buffer);
+
+		free(prober->marks);
+		free(prober->fmt.levels);
+	}
+
+	free(probers);
+}
+
+/* Sets up a prober for every physical core to probe on, up to --cores. The
+ * first prober uses the given target and the eviction target from the
+ * arguments, the others get target buffers of their own. The perf timer only
+ * counts the cycles of the thread that opened it, so it limits probing to a
+ * single core.
+ */
+static struct prober *new_probers(size_t *nprobers, struct args *args,
+	struct page_format *fmt, volatile void *target)
+{
+	const char *timer = get_timer_name(args->timer);
+	struct prober *probers, *prober;
+	size_t *cpus;
+	size_t i, n;
+
+	n = max(args->ncores, 1);
+
+	if (n > 1 && timer && strcmp(timer, "perf") == 0) {
+		dprintf("the perf timer cannot be read from other threads, "
+			"probing on a single core.\n");
+		n = 1;
+	}
+
+	/* There is at most one prober per online CPU. */
+	n = min(n, get_cpu_count());
+
+	if (!(cpus = malloc(n * sizeof *cpus)))
+		return NULL;
+
+	n = pick_prober_cpus(cpus, n, args);
+
+	if (!(probers = calloc(n, sizeof *probers)))
+		goto err_free_cpus;
+
+	for (i = 0, prober = probers; i < n; ++i, ++prober) {
+		prober->fmt = *fmt;
+		prober->args = args;
+		prober->cpu = cpus[i];
+		prober->batched = (n > 1);
+
+		if (!(prober->fmt.levels = malloc(fmt->nlevels *
+			sizeof *prober->fmt.levels)))
+			goto err_del_probers;
+
+		if (!(prober->marks = malloc(max(args->nruns, 1))))
+			goto err_del_probers;
+
+		if (!i) {
+			prober->target = target;
+			prober->evict_target = (void *)args->evict_target;
+			continue;
+		}
+
+		if (!(prober->buffer = new_buffer(fmt, NULL,
+			args->sparse ? BUFFER_SPARSE : 0))) {
+			dprintf("unable to allocate the target buffer.\n");
+			goto err_del_probers;
+		}
+
+		prefault_buffer(prober->buffer, fmt);
+		prober->target = prober->buffer->data;
+	}
+
+	free(cpus);
+	*nprobers = n;
+
+	return probers;
+
+err_del_probers:
+	del_probers(probers, n);
+err_free_cpus:
+	free(cpus);
+	return NULL;
+}
+
+/* Allocates the timings of page level n for every prober, copies the number
+ * of cache entries found so far and sets up the eviction buffer for the given
+ * maximum number of cache entries of the page level.
+ */
+static int start_level(struct prober *probers, size_t nprobers,
+	struct page_format *fmt, size_t n, size_t max_entries)
+{
+	struct page_level *level = fmt->levels + n;
+	struct prober *prober;
+	size_t ncells = level->npages * (level->table_size /
+		probers->args->line_size);
+	size_t i;
+
+	for (i = 0, prober = probers; i < nprobers; ++i, ++prober) {
+		memcpy(prober->fmt.levels, fmt->levels,
+			fmt->nlevels * sizeof *fmt->levels);
+
+		if (!(prober->timings = malloc(ncells * sizeof *prober->timings)))
+			return -1;
+
+		if (!(prober->ntimings = malloc(ncells *
+			sizeof *prober->ntimings)))
+			return -1;
+
+		if (reserve_cache_entries(prober, n, max_entries) < 0)
+			return -1;
 	}
 
 	return 0;
 }
 
+static void stop_level(struct prober *probers, size_t nprobers)
+{
+	struct prober *prober;
+	size_t i;
+
+	for (i = 0, prober = probers; i < nprobers; ++i, ++prober) {
+		if (prober->cache)
+			del_cache(prober->cache);
+
+		free(prober->ntimings);
+		free(prober->timings);
+		prober->cache = NULL;
+		prober->capacity = 0;
+		prober->ntimings = NULL;
+		prober->timings = NULL;
+	}
+}
+
+/* Calibrates the profiler once up front with an eviction buffer for the page
+ * format as given, as the probers share the calibration.
+ */
+static int calibrate_evict_set(struct args *args, struct page_format *fmt,
+	volatile void *target)
+{
+	int cache_flags = (args->evict_hugepages ? CACHE_HUGEPAGES : 0) |
+		(args->sparse ? CACHE_SPARSE : 0);
+	struct cache *cache;
+	int ret = -1;
+
+	if (!(cache = new_cache(fmt, (void *)args->evict_target,
+		args->cache_size, args->line_size, cache_flags))) {
+		dprintf("unable to allocate the eviction set.\n");
+		return -1;
+	}
+
+	if (set_evict_mode(cache, args->evict_mode) < 0) {
+		dprintf("unable to set up the eviction mode.\n");
+		goto err_del_cache;
+	}
+
+	prefault_cache(cache);
+	ret = setup_profiler(cache, args, target);
+
+err_del_cache:
+	del_cache(cache);
+	return ret;
+}
+
+int brute_force_evict_set(struct args *args, struct page_format *fmt,
+	volatile void *target)
+{
+	struct page_level *level;
+	struct prober *probers;
+	size_t nprobers;
+	size_t ncache_entries, max_entries;
+	size_t i;
+	int ret = -1;
+
+	if (calibrate_evict_set(args, fmt, target) < 0)
+		return -1;
+
+	if (!(probers = new_probers(&nprobers, args, fmt, target))) {
+		dprintf("unable to set up the probers.\n");
+		return -1;
+	}
+
+	if (nprobers > 1) {
+		printf("probing on %zu cores: CPU", nprobers);
+
+		for (i = 0; i < nprobers; ++i)
+			printf(" %zu", probers[i].cpu);
+
+		printf("\n");
+	}
+
+	for (i = 0, level = fmt->levels; i < fmt->nlevels; ++i, ++level) {
+		if (level->npages == 0)
+			continue;
+
+		max_entries = get_max_cache_entries(fmt, i);
+
+		if (start_level(probers, nprobers, fmt, i, max_entries) < 0) {
+			stop_level(probers, nprobers);
+			continue;
+		}
+
+		ncache_entries = search_cache_entries(probers, nprobers, i,
+			max_entries);
+
+		if (ncache_entries && nprobers > 1 &&
+			check_agreement(probers, nprobers, i, ncache_entries) < 0)
+			ncache_entries = 0;
+
+		stop_level(probers, nprobers);
+
+		if (!ncache_entries)
+			goto err_del_probers;
+
+		level->ncache_entries = ncache_entries;
+		printf("found PL%zu cache entries: %zu\n", (i + 1),
+			level->ncache_entries);
+	}
+
+	ret = 0;
+
+err_del_probers:
+	del_probers(probers, nprobers);
+	return ret;
+}
+
 int main(int argc, const char *argv[])
 {
 	struct args args = {
@@ -146,14 +777,19 @@ int main(int argc, const char *argv[])
 		.nentries = { SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX },
 		.nrounds = 10,
 		.line_size = 64,
-		.nruns = 1,
+		/* Set by get_sprt_runs() unless given. */
+		.nruns = 0,
 		.threshold = 70.0,
 		.output = "results",
+		.timer_cpu = -1,
+		.serialize = -1,
 		.target = 0,
 		.evict_target = 0,
 	};
 	struct buffer *buffer;
 	struct page_format *page_format;
+	struct timer_calib timer_calib;
+	int ret = -1;
 
 	if (check_transparent_hugepages()) {
 		dprintf("transparent huge pages seem to be enabled.\n"
@@ -169,6 +805,12 @@ int main(int argc, const char *argv[])
 
 	detect_args(&args);
 
+	if (!args.nruns)
+		args.nruns = get_sprt_runs(args.threshold, args.sprt_error);
+
+	set_solver_threads(args.nsolver_threads);
+	set_score_mode(args.score);
+
 	if (!args.line_size) {
 		dprintf("unable to detect line size, please specify the cache "
 			"line size using --line-size.\n");
@@ -189,7 +831,12 @@ int main(int argc, const char *argv[])
 		return -1;
 	}
 
-	if (init_profiler() < 0) {
+	if (args.timer_cpu < 0)
+		args.timer_cpu = pick_timer_cpu(args.cpu);
+
+	set_timer_cpu(args.timer_cpu);
+
+	if (init_profiler(args.timer) < 0) {
 		dprintf("unable to set up the profiler.\n");
 		return -1;
 	}
@@ -199,25 +846,47 @@ int main(int argc, const char *argv[])
 		return -1;
 	}
 
-	if (!(buffer = new_buffer(page_format, (void *)args.target))) {
+	if (!(buffer = new_buffer(page_format, (void *)args.target,
+		args.sparse ? BUFFER_SPARSE : 0))) {
 		dprintf("unable to allocate the target buffer.\n");
 		return -1;
 	}
 
+	prefault_buffer(buffer, page_format);
+
+	if (calibrate_timer(&timer_calib, 1000) < 0) {
+		dprintf("unable to calibrate the timer.\n");
+		goto err_del_buffer;
+	}
+
+	printf("Timer: %s (resolution %" PRIu64 ", overhead %" PRIu64
+		", %lf ticks/ns, %lf%% jitter)\n", get_timer_name(args.timer),
+		timer_calib.resolution, timer_calib.overhead,
+		timer_calib.ticks_per_ns, 100.0 * timer_calib.jitter);
+
+	if (args.timer_ns && set_timer_ns(&timer_calib) < 0) {
+		dprintf("unable to report timings in nanoseconds.\n");
+		goto err_del_buffer;
+	}
+
 #if defined(__i386__) || defined(__x86_64__)
 	printf("Detected CPU name: %s (%s)\n\n", cpuid_get_cpu_name(), cpuid_get_cpu_model());
 #endif
 
 	srand(time(0));
 
-	brute_force_evict_set(page_format, (void *)args.evict_target,
-		args.cache_size, args.line_size, args.nrounds, args.nruns,
-		args.threshold, buffer->data);
+	if (brute_force_evict_set(&args, page_format, buffer->data) < 0) {
+		dprintf("unable to find the number of cache entries.\n");
+		goto err_del_buffer;
+	}
+
+	ret = 0;
 
+err_del_buffer:
 	del_buffer(buffer);
 
 	if (args.page_format)
 		free(args.page_format);
 
-	return 0;
+	return ret;
 }
@@ -3,12 +3,85 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
 
 #include "macros.h"
 #include "solver.h"
 
+typedef double v2df __attribute__((vector_size(16)));
+
+static size_t solver_nthreads = 1;
+static int solver_score = SCORE_SUM;
+
+static const char *score_names[SCORE_NMODES] = {
+	[SCORE_SUM] = "sum",
+	[SCORE_LIKELIHOOD] = "likelihood",
+};
+
+static const char *margin_units[SCORE_NMODES] = {
+	[SCORE_SUM] = "pages",
+	[SCORE_LIKELIHOOD] = "nats",
+};
+
+int get_score_mode(const char *name)
+{
+	int mode;
+
+	for (mode = 0; mode < SCORE_NMODES; ++mode) {
+		if (strcmp(score_names[mode], name) == 0)
+			return mode;
+	}
+
+	return -1;
+}
+
+const char *get_score_mode_name(int mode)
+{
+	if (mode < 0 || mode >= SCORE_NMODES)
+		return "unknown";
+
+	return score_names[mode];
+}
+
+void list_score_modes(FILE *f)
+{
+	int mode;
+
+	for (mode = 0; mode < SCORE_NMODES; ++mode)
+		fprintf(f, "%s ", score_names[mode]);
+}
+
+void set_score_mode(int mode)
+{
+	solver_score = mode;
+}
+
+int get_current_score_mode(void)
+{
+	return solver_score;
+}
+
+/* Returns what solve_joint() returns for the selected score mode. */
+const char *get_joint_measure(void)
+{
+	return solver_score == SCORE_LIKELIHOOD ? "probability" :
+		"margin in pages";
+}
+
+/* Returns the unit of the margins that get_margin() returns for the selected
+ * score mode.
+ */
+const char *get_margin_unit(void)
+{
+	return margin_units[solver_score];
+}
+
 void normalise_timings(double *ntimings, uint64_t *timings,
 	size_t ncache_lines, size_t npages)
 {
@@ -33,7 +106,7 @@ void normalise_timings(double *ntimings, uint64_t *timings,
 			if (hi == lo) {
 				ntiming = 1.0;
 			} else {
-				ntiming = timing / (hi - lo);
+				ntiming = (double)timing / (hi - lo);
 			}
 
 			ntimings[y * ncache_lines + x] = ntiming;
@@ -41,6 +114,152 @@ void normalise_timings(double *ntimings, uint64_t *timings,
 	}
 }
 
+/* A normal distribution of the timings of either cache hits or misses. */
+struct component {
+	double weight;
+	double mean;
+	double var;
+};
+
+/* The variance of a component may not drop below a tick, as the timings are
+ * integers.
+ */
+#define MIN_VARIANCE 1.0
+
+/* The log-likelihood ratio of a single cell is bounded, such that a single
+ * outlier cannot decide the score of a candidate.
+ */
+#define MAX_LLR 8.0
+
+#define EM_ITERATIONS 64
+
+static int cmp_double(const void *lhs_, const void *rhs_)
+{
+	const double *lhs = lhs_, *rhs = rhs_;
+
+	return (*lhs > *rhs) - (*lhs < *rhs);
+}
+
+static double log_normal(struct component *c, double x)
+{
+	return -0.5 * (log(2 * M_PI * c->var) + (x - c->mean) * (x - c->mean) /
+		c->var);
+}
+
+/* Fits a mixture of two normal distributions to the timings using
+ * expectation-maximisation, where the first component models the cache hits
+ * and the second one the cache misses. Most cells are hits, so the components
+ * start at the median and at the 95th percentile of the timings.
+ */
+static int fit_mixture(struct component *hit, struct component *miss,
+	uint64_t *timings, size_t n)
+{
+	double *xs;
+	double x, lhit, lmiss, r;
+	double sr, srx, srxx, sh, shx, shxx;
+	size_t i, k;
+
+	if (!n || !(xs = malloc(n * sizeof *xs)))
+		return -1;
+
+	for (i = 0; i < n; ++i)
+		xs[i] = (double)timings[i];
+
+	qsort(xs, n, sizeof *xs, cmp_double);
+
+	hit->mean = xs[n / 2];
+	miss->mean = max(xs[n * 95 / 100], hit->mean + 1);
+	hit->var = miss->var = max((miss->mean - hit->mean) *
+		(miss->mean - hit->mean) / 16, MIN_VARIANCE);
+	hit->weight = 0.9;
+	miss->weight = 0.1;
+
+	for (k = 0; k < EM_ITERATIONS; ++k) {
+		sr = srx = srxx = sh = shx = shxx = 0;
+
+		for (i = 0; i < n; ++i) {
+			x = xs[i];
+			lhit = log(hit->weight) + log_normal(hit, x);
+			lmiss = log(miss->weight) + log_normal(miss, x);
+
+			/* The responsibility of the miss component. */
+			r = 1.0 / (1.0 + exp(lhit - lmiss));
+
+			sr += r;
+			srx += r * x;
+			srxx += r * x * x;
+			sh += 1 - r;
+			shx += (1 - r) * x;
+			shxx += (1 - r) * x * x;
+		}
+
+		if (sr < 1 || sh < 1)
+			break;
+
+		miss->weight = sr / n;
+		miss->mean = srx / sr;
+		miss->var = max(srxx / sr - miss->mean * miss->mean, MIN_VARIANCE);
+		hit->weight = sh / n;
+		hit->mean = shx / sh;
+		hit->var = max(shxx / sh - hit->mean * hit->mean, MIN_VARIANCE);
+	}
+
+	free(xs);
+
+	if (miss->mean < hit->mean) {
+		struct component tmp = *hit;
+
+		*hit = *miss;
+		*miss = tmp;
+	}
+
+	return 0;
+}
+
+/* Scores every cell by the log-likelihood ratio of a cache miss over a cache
+ * hit, using a mixture of two normal distributions fitted to the timings of
+ * the page level. Timings beyond the mean of either component count as that
+ * mean, such that the ratio grows with the timing. Summing these along a
+ * diagonal gives the log-likelihood ratio of the candidate.
+ */
+static void weigh_timings(double *scores, uint64_t *timings,
+	size_t ncache_lines, size_t npages)
+{
+	struct component hit, miss;
+	size_t i, n = ncache_lines * npages;
+	double x, llr;
+
+	if (fit_mixture(&hit, &miss, timings, n) < 0) {
+		normalise_timings(scores, timings, ncache_lines, npages);
+		return;
+	}
+
+	for (i = 0; i < n; ++i) {
+		x = (double)timings[i];
+		x = max(x, hit.mean);
+		x = min(x, miss.mean);
+		llr = log_normal(&miss, x) - log_normal(&hit, x);
+
+		scores[i] = max(min(llr, MAX_LLR), -MAX_LLR);
+	}
+}
+
+/* Turns the timings into the scores that the solver sums, using the selected
+ * score mode.
+ */
+void score_timings(double *scores, uint64_t *timings,
+	size_t ncache_lines, size_t npages)
+{
+	switch (solver_score) {
+	case SCORE_LIKELIHOOD:
+		weigh_timings(scores, timings, ncache_lines, npages);
+		break;
+	default:
+		normalise_timings(scores, timings, ncache_lines, npages);
+		break;
+	}
+}
+
 double solve_line(double *timings, size_t line, size_t page,
 	size_t ncache_lines, size_t npages, size_t npages_per_line)
 {
@@ -62,21 +281,192 @@ double solve_line(double *timings, size_t line, size_t page,
 	return sum;
 }
 
+/* Picks the best line and page by scoring every candidate with solve_line()
+ * on its own.
+ */
+static void solve_lines_scalar(size_t *best_line, size_t *best_page,
+	double *timings, size_t ncache_lines, size_t npages,
+	size_t npages_per_line)
+{
+	size_t line, page;
+	double line_sum;
+	double best_sum = 0;
+
+	for (line = 0; line < ncache_lines; ++line) {
+		for (page = 0; page < npages_per_line; ++page) {
+			line_sum = solve_line(timings, line, page, ncache_lines, npages, npages_per_line);
+
+			if (line_sum > best_sum) {
+				best_sum = line_sum;
+				*best_line = line;
+				*best_page = page;
+			}
+		}
+	}
+}
+
+void set_solver_threads(size_t nthreads)
+{
+	solver_nthreads = max(nthreads, 1);
+}
+
+/* Adds the row src to the row dst, two doubles at a time. */
+static void add_row(double *dst, const double *src, size_t n)
+{
+	v2df lhs, rhs;
+	size_t i;
+
+	for (i = 0; i + 2 <= n; i += 2) {
+		memcpy(&lhs, dst + i, sizeof lhs);
+		memcpy(&rhs, src + i, sizeof rhs);
+		lhs += rhs;
+		memcpy(dst + i, &lhs, sizeof lhs);
+	}
+
+	for (; i < n; ++i)
+		dst[i] += src[i];
+}
+
+/* Calculates the score of solve_line() for every line at once for the given
+ * page. For every row, the cache line that is summed is the line plus the
+ * same shift, so the row rotated by that shift is added to the scores of all
+ * lines. Every score still sums its rows in the same order as solve_line(),
+ * such that the results are identical.
+ */
+static void solve_page(double *sums, double *timings, size_t page,
+	size_t ncache_lines, size_t npages, size_t npages_per_line)
+{
+	double *row_timings;
+	size_t row, shift;
+
+	memset(sums, 0, ncache_lines * sizeof *sums);
+
+	for (row = 0; row < npages; ++row) {
+		shift = ((row + page) / npages_per_line) % ncache_lines;
+		row_timings = timings + row * ncache_lines;
+
+		add_row(sums, row_timings + shift, ncache_lines - shift);
+		add_row(sums + ncache_lines - shift, row_timings, shift);
+	}
+}
+
+/* A range of pages to calculate the scores for on a thread. */
+struct solve_job {
+	double *sums;
+	double *timings;
+	size_t first_page;
+	size_t last_page;
+	size_t ncache_lines;
+	size_t npages;
+	size_t npages_per_line;
+	pthread_t thread;
+	int started;
+};
+
+static void *solve_pages(void *data)
+{
+	struct solve_job *job = data;
+	size_t page;
+
+	for (page = job->first_page; page < job->last_page; ++page) {
+		solve_page(job->sums + page * job->ncache_lines, job->timings,
+			page, job->ncache_lines, job->npages,
+			job->npages_per_line);
+	}
+
+	return NULL;
+}
+
+/* Calculates the scores of all the pages, split over the solver threads. */
+static void solve_all_pages(double *sums, double *timings,
+	size_t ncache_lines, size_t npages, size_t npages_per_line)
+{
+	struct solve_job *jobs, *job;
+	size_t nthreads = min(solver_nthreads, npages_per_line);
+	size_t i;
+
+	if (nthreads < 2 || !(jobs = calloc(nthreads, sizeof *jobs))) {
+		struct solve_job single = {
+			.sums = sums,
+			.timings = timings,
+			.last_page = npages_per_line,
+			.ncache_lines = ncache_lines,
+			.npages = npages,
+			.npages_per_line = npages_per_line,
+		};
+
+		solve_pages(&single);
+		return;
+	}
+
+	for (i = 0, job = jobs; i < nthreads; ++i, ++job) {
+		job->sums = sums;
+		job->timings = timings;
+		job->first_page = i * npages_per_line / nthreads;
+		job->last_page = (i + 1) * npages_per_line / nthreads;
+		job->ncache_lines = ncache_lines;
+		job->npages = npages;
+		job->npages_per_line = npages_per_line;
+
+		/* The calling thread takes the first job. */
+		if (i)
+			job->started = pthread_create(&job->thread, NULL,
+				solve_pages, job) == 0;
+	}
+
+	for (i = 0, job = jobs; i < nthreads; ++i, ++job) {
+		if (!job->started)
+			solve_pages(job);
+	}
+
+	for (i = 0, job = jobs; i < nthreads; ++i, ++job) {
+		if (job->started)
+			pthread_join(job->thread, NULL);
+	}
+
+	free(jobs);
+}
+
+/* Calculates the score of every line for every page, indexed by page and
+ * then by line.
+ */
+static double *score_lines(double *timings, size_t ncache_lines,
+	size_t npages, size_t npages_per_line)
+{
+	double *sums;
+
+	if (!(sums = malloc(npages_per_line * ncache_lines * sizeof *sums)))
+		return NULL;
+
+	solve_all_pages(sums, timings, ncache_lines, npages, npages_per_line);
+
+	return sums;
+}
+
 void solve_lines(size_t *best_line, size_t *best_page,
 	double *timings, size_t ncache_lines, size_t npages,
 	size_t npages_per_line)
 {
-	/* solve all possibilities using solve_line and pick the best one
-	 * and store it in best_line and best_page.
+	/* solve all possibilities, the lines of one page at a time, and pick
+	 * the best one in the same order as solve_line would and store it in
+	 * best_line and best_page.
 	 */
 
 	size_t line, page;
 	double line_sum;
 	double best_sum = 0;
+	double *sums;
+
+	if (!(sums = score_lines(timings, ncache_lines, npages,
+		npages_per_line))) {
+		solve_lines_scalar(best_line, best_page, timings, ncache_lines,
+			npages, npages_per_line);
+		return;
+	}
 
 	for (line = 0; line < ncache_lines; ++line) {
 		for (page = 0; page < npages_per_line; ++page) {
-			line_sum = solve_line(timings, line, page, ncache_lines, npages, npages_per_line);
+			line_sum = sums[page * ncache_lines + line];
 
 			if (line_sum > best_sum) {
 				best_sum = line_sum;
@@ -85,4 +475,200 @@ void solve_lines(size_t *best_line, size_t *best_page,
 			}
 		}
 	}
+
+	free(sums);
+}
+
+/* Ranks the candidates by the given scores, indexed by page and then by line,
+ * and stores the best nsolutions of them in descending order. Candidates with
+ * equal scores are ranked in the order solve_lines() visits them. Returns the
+ * number of solutions stored.
+ */
+static size_t rank_sums(struct solution *solutions, size_t nsolutions,
+	double *sums, size_t ncache_lines, size_t npages_per_line)
+{
+	struct solution candidate;
+	size_t line, page;
+	size_t n = 0, i;
+
+	if (!nsolutions)
+		return 0;
+
+	for (line = 0; line < ncache_lines; ++line) {
+		for (page = 0; page < npages_per_line; ++page) {
+			candidate.line = line;
+			candidate.page = page;
+			candidate.score = sums[page * ncache_lines + line];
+
+			if (n == nsolutions &&
+				candidate.score <= solutions[n - 1].score)
+				continue;
+
+			if (n < nsolutions)
+				++n;
+
+			for (i = n - 1; i > 0 &&
+				solutions[i - 1].score < candidate.score; --i)
+				solutions[i] = solutions[i - 1];
+
+			solutions[i] = candidate;
+		}
+	}
+
+	return n;
+}
+
+/* Ranks the candidate lines and pages by their score and stores the best
+ * nsolutions of them in descending order. Candidates with equal scores are
+ * ranked in the order solve_lines() visits them, such that the first
+ * solution is the one solve_lines() picks. Returns the number of solutions
+ * stored.
+ */
+size_t rank_lines(struct solution *solutions, size_t nsolutions,
+	double *timings, size_t ncache_lines, size_t npages,
+	size_t npages_per_line)
+{
+	size_t n;
+	double *sums;
+
+	if (!nsolutions || !(sums = score_lines(timings, ncache_lines, npages,
+		npages_per_line)))
+		return 0;
+
+	n = rank_sums(solutions, nsolutions, sums, ncache_lines,
+		npages_per_line);
+	free(sums);
+
+	return n;
+}
+
+/* Returns the margin between the best and the second best solution. With sum
+ * scores, every page adds at most one to the score of a solution, so the
+ * margin is normalised by the number of pages to the fraction of pages that
+ * tell them apart. With likelihood scores, the difference of the scores
+ * already is the log-likelihood ratio of the best over the second best
+ * solution in nats, which grows with the evidence and is left as is. Either
+ * way, a margin close to zero means that the best solution barely won.
+ */
+double get_margin(struct solution *solutions, size_t nsolutions,
+	size_t npages)
+{
+	double margin;
+
+	if (!nsolutions || !npages)
+		return 0;
+
+	margin = solutions[0].score;
+
+	if (nsolutions > 1)
+		margin -= solutions[1].score;
+
+	if (solver_score == SCORE_LIKELIHOOD)
+		return margin;
+
+	return margin / npages;
+}
+
+struct solver_state *new_solver_state(size_t ncache_lines,
+	size_t npages_per_line, double error_rate)
+{
+	struct solver_state *state;
+
+	if (!ncache_lines || !npages_per_line)
+		return NULL;
+
+	if (!(state = malloc(sizeof *state)))
+		return NULL;
+
+	if (!(state->sums = malloc(npages_per_line * ncache_lines *
+		sizeof *state->sums)))
+		goto err_free_state;
+
+	state->ncache_lines = ncache_lines;
+	state->npages_per_line = npages_per_line;
+	state->error_rate = error_rate;
+	reset_solver_state(state);
+
+	return state;
+
+err_free_state:
+	free(state);
+	return NULL;
+}
+
+void del_solver_state(struct solver_state *state)
+{
+	if (!state)
+		return;
+
+	free(state->sums);
+	free(state);
+}
+
+void reset_solver_state(struct solver_state *state)
+{
+	memset(state->sums, 0, state->npages_per_line * state->ncache_lines *
+		sizeof *state->sums);
+	state->nrows = 0;
+}
+
+/* Adds the next row of normalised timings to the score of every candidate,
+ * in the same way solve_page() does, such that the scores after the last row
+ * are identical to those of score_lines().
+ */
+void update_solver_state(struct solver_state *state, double *timings)
+{
+	size_t ncache_lines = state->ncache_lines;
+	size_t page, shift;
+	double *sums;
+
+	for (page = 0; page < state->npages_per_line; ++page) {
+		shift = ((state->nrows + page) / state->npages_per_line) %
+			ncache_lines;
+		sums = state->sums + page * ncache_lines;
+
+		add_row(sums, timings + shift, ncache_lines - shift);
+		add_row(sums + ncache_lines - shift, timings, shift);
+	}
+
+	++state->nrows;
+}
+
+size_t rank_solver_state(struct solution *solutions, size_t nsolutions,
+	struct solver_state *state)
+{
+	return rank_sums(solutions, nsolutions, state->sums,
+		state->ncache_lines, state->npages_per_line);
+}
+
+/* Tells whether the best candidate leads every other candidate by enough to
+ * stop taking rows. A row adds between zero and one to every score, so the
+ * difference between two scores changes by at most one per row. By
+ * Hoeffding's inequality, a candidate that is not better on average leads by
+ * d after n rows with a probability of at most exp(-d^2 / 2n). Taking the
+ * union over all candidates, and over every row at which this is checked by
+ * spending error_rate / (n (n + 1)) on the check after row n, the lead is
+ * significant once d^2 / 2n exceeds log(ncandidates n (n + 1) / error_rate).
+ * As these shares sum up to error_rate, stopping at the first significant
+ * row keeps the error rate. Every page offset has to be seen at least once,
+ * so at least npages_per_line rows are required.
+ */
+int is_solver_done(struct solver_state *state)
+{
+	struct solution solutions[2];
+	size_t ncandidates = state->ncache_lines * state->npages_per_line;
+	double lead, n;
+
+	if (state->error_rate <= 0 || state->nrows < state->npages_per_line ||
+		ncandidates < 2)
+		return 0;
+
+	if (rank_solver_state(solutions, 2, state) < 2)
+		return 0;
+
+	lead = solutions[0].score - solutions[1].score;
+	n = (double)state->nrows;
+
+	return lead * lead / (2.0 * n) >=
+		log(ncandidates * n * (n + 1.0) / state->error_rate);
 }
@@ -0,0 +1,131 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+#include "sparse.h"
+
+#define MAX_MAP_ATTEMPTS 16
+
+static int cmp_size(const void *lhs_, const void *rhs_)
+{
+	const size_t *lhs = lhs_, *rhs = rhs_;
+
+	if (*lhs < *rhs)
+		return -1;
+
+	if (*lhs > *rhs)
+		return 1;
+
+	return 0;
+}
+
+/* Picks a random base address for a sparse buffer spanning the given number
+ * of bytes, staying clear of both ends of the user address space.
+ */
+static char *pick_base(size_t span, size_t granularity)
+{
+	uintptr_t limit = get_va_limit();
+	uintptr_t lo = limit / 16, hi;
+	uint64_t r = 0;
+	size_t i;
+
+	if (span >= limit - 2 * lo)
+		return NULL;
+
+	hi = limit - lo - span;
+
+	/* RAND_MAX may be as small as 2^15 - 1, so take eight bits of every
+	 * call to get a full-width random value.
+	 */
+	for (i = 0; i < sizeof r; ++i)
+		r = (r << 8) | (rand() & 0xff);
+
+	return (char *)((lo + (uintptr_t)(r % (hi - lo))) &
+		~(uintptr_t)(granularity - 1));
+}
+
+/* Maps length bytes at every given offset from the base address, merging
+ * ranges that overlap once rounded to the mapping granularity. The base
+ * address is the target if given. Otherwise random base addresses are
+ * tried until one is found where none of the ranges collides with existing
+ * mappings. The offsets are sorted in place.
+ */
+int map_sparse(struct sparse_map *map, void *target, size_t *offsets,
+	size_t noffsets, size_t length)
+{
+	size_t granularity = get_map_granularity();
+	size_t start, end;
+	size_t attempt, i;
+
+	map->base = NULL;
+	map->nranges = 0;
+
+	if (!(map->ranges = malloc(2 * max(noffsets, 1) * sizeof *map->ranges)))
+		return -1;
+
+	qsort(offsets, noffsets, sizeof *offsets, cmp_size);
+
+	for (i = 0; i < noffsets; ++i) {
+		start = offsets[i] & ~(granularity - 1);
+		end = (offsets[i] + length + granularity - 1) & ~(granularity - 1);
+
+		if (map->nranges && start <= map->ranges[2 * map->nranges - 1]) {
+			map->ranges[2 * map->nranges - 1] = max(end,
+				map->ranges[2 * map->nranges - 1]);
+			continue;
+		}
+
+		map->ranges[2 * map->nranges] = start;
+		map->ranges[2 * map->nranges + 1] = end;
+		++map->nranges;
+	}
+
+	if (!map->nranges)
+		goto err_free_ranges;
+
+	for (attempt = 0; attempt < (target ? 1 : MAX_MAP_ATTEMPTS); ++attempt) {
+		if (!(map->base = target ? target : pick_base(
+			map->ranges[2 * map->nranges - 1], granularity)))
+			break;
+
+		for (i = 0; i < map->nranges; ++i) {
+			if (map_fixed(map->base + map->ranges[2 * i],
+				map->ranges[2 * i + 1] - map->ranges[2 * i]) < 0)
+				break;
+		}
+
+		if (i == map->nranges)
+			return 0;
+
+		while (i--) {
+			unmap_fixed(map->base + map->ranges[2 * i],
+				map->ranges[2 * i + 1] - map->ranges[2 * i]);
+		}
+	}
+
+err_free_ranges:
+	free(map->ranges);
+	map->ranges = NULL;
+	map->nranges = 0;
+	return -1;
+}
+
+void unmap_sparse(struct sparse_map *map)
+{
+	size_t i;
+
+	for (i = 0; i < map->nranges; ++i) {
+		unmap_fixed(map->base + map->ranges[2 * i],
+			map->ranges[2 * i + 1] - map->ranges[2 * i]);
+	}
+
+	free(map->ranges);
+	map->ranges = NULL;
+	map->nranges = 0;
+}
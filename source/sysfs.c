@@ -0,0 +1,39 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdlib.h>
+
+#include "sysfs.h"
+
+/* Picks the first online CPU on a physical core other than the cores of the
+ * given CPUs, where negative CPUs are ignored. Returns -1 if every online CPU
+ * shares a core with one of the given CPUs.
+ */
+int pick_other_core_cpu(const int *excluded, size_t nexcluded)
+{
+	size_t *online, nonline;
+	size_t i, j, core;
+	int ret = -1;
+
+	if (!(online = get_online_cpus(&nonline)))
+		return -1;
+
+	for (i = 0; i < nonline && ret < 0; ++i) {
+		core = get_core_cpu(online[i]);
+
+		for (j = 0; j < nexcluded; ++j) {
+			if (excluded[j] >= 0 &&
+				get_core_cpu((size_t)excluded[j]) == core)
+				break;
+		}
+
+		if (j == nexcluded)
+			ret = (int)online[i];
+	}
+
+	free(online);
+
+	return ret;
+}
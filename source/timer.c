@@ -0,0 +1,311 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "config.h"
+#include "macros.h"
+#include "sysfs.h"
+#include "thread.h"
+#include "timer.h"
+
+/* The timers supported by the architecture and platform, with the default
+ * timer first.
+ */
+static struct timer *timers[] = {
+#if defined(__x86_64__)
+#if CONFIG_USE_RDTSCP || !CONFIG_USE_RDTSC
+	&rdtscp_timer,
+	&rdtsc_timer,
+#else
+	&rdtsc_timer,
+	&rdtscp_timer,
+#endif
+#elif defined(__aarch64__)
+	&cntvct_timer,
+#endif
+	&thread_timer,
+#if defined(__linux__)
+	&perf_timer,
+#endif
+	&monotonic_timer,
+	NULL,
+};
+
+static struct timer *timer;
+uint64_t (*read_timer)(void);
+int timer_kind;
+uint64_t timer_scale;
+
+static pthread_t timer_thread;
+static volatile uint64_t timer_ticks;
+static volatile int timer_state;
+static atomic_int timer_stop;
+static int timer_cpu = -1;
+
+/* The length and number of the windows over which the rate of the timer is
+ * measured.
+ */
+#define CALIB_WINDOW_NS 10000000
+#define CALIB_NWINDOWS 9
+
+static void *increment_ticks(void *data)
+{
+	(void)data;
+
+	/* Report whether the thread could be pinned before counting. */
+	if (timer_cpu >= 0 && pin_cpu(timer_cpu) != 0) {
+		timer_state = -1;
+		return NULL;
+	}
+
+	timer_state = 1;
+
+	/* The loop never reaches a cancellation point, so it polls a flag to
+	 * stop instead.
+	 */
+	while (!atomic_load_explicit(&timer_stop, memory_order_relaxed))
+		++timer_ticks;
+
+	return NULL;
+}
+
+static void fini_thread(void)
+{
+	atomic_store(&timer_stop, 1);
+	pthread_join(timer_thread, NULL);
+}
+
+/* Starts the counting thread, pinned to the CPU set using set_timer_cpu(), and
+ * waits until it is running on that CPU.
+ */
+static int init_thread(void)
+{
+	timer_ticks = 0;
+	timer_state = 0;
+	atomic_store(&timer_stop, 0);
+
+	if (pthread_create(&timer_thread, NULL, increment_ticks, NULL) != 0)
+		return -1;
+
+	while (!timer_state)
+		sched_yield();
+
+	if (timer_state < 0) {
+		dprintf("unable to pin the timer thread to CPU %d.\n",
+			timer_cpu);
+		pthread_join(timer_thread, NULL);
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint64_t read_thread(void)
+{
+	return timer_ticks;
+}
+
+/* Uses a thread that keeps incrementing a shared counter. */
+struct timer thread_timer = {
+	.name = "thread",
+	.init = init_thread,
+	.fini = fini_thread,
+	.read = read_thread,
+};
+
+int get_timer(const char *name)
+{
+	int i;
+
+	for (i = 0; timers[i]; ++i) {
+		if (strcmp(timers[i]->name, name) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+const char *get_timer_name(int i)
+{
+	if (i < 0 || (size_t)i >= sizeof timers / sizeof *timers - 1)
+		return NULL;
+
+	return timers[i]->name;
+}
+
+void list_timers(FILE *f)
+{
+	int i;
+
+	for (i = 0; timers[i]; ++i)
+		fprintf(f, "%s ", timers[i]->name);
+}
+
+/* Picks a CPU for the counting thread on a physical core other than that of
+ * the given CPU that is used to measure, or returns -1 if there is none.
+ */
+int pick_timer_cpu(size_t cpu)
+{
+	int excluded[] = { (int)cpu };
+
+	return pick_other_core_cpu(excluded, 1);
+}
+
+/* Sets the CPU to pin the counting thread to, or -1 to leave it unpinned. */
+void set_timer_cpu(int cpu)
+{
+	timer_cpu = cpu;
+}
+
+/* Sets up the given timer and uses it for all subsequent timestamps. */
+int init_timer(int i)
+{
+	if (!get_timer_name(i))
+		return -1;
+
+	fini_timer();
+
+	if (timers[i]->init && timers[i]->init() < 0)
+		return -1;
+
+	timer = timers[i];
+	read_timer = timer->read;
+	timer_kind = timer->kind;
+	timer_scale = 0;
+
+	return 0;
+}
+
+void fini_timer(void)
+{
+	if (timer && timer->fini)
+		timer->fini();
+
+	timer = NULL;
+}
+
+static int cmp_uint64(const void *lhs_, const void *rhs_)
+{
+	const uint64_t *lhs = lhs_, *rhs = rhs_;
+
+	if (*lhs < *rhs)
+		return -1;
+
+	if (*lhs > *rhs)
+		return 1;
+
+	return 0;
+}
+
+static int cmp_double(const void *lhs_, const void *rhs_)
+{
+	const double *lhs = lhs_, *rhs = rhs_;
+
+	if (*lhs < *rhs)
+		return -1;
+
+	if (*lhs > *rhs)
+		return 1;
+
+	return 0;
+}
+
+/* Measures the rate of the current timer against the monotonic clock of the
+ * system over a number of short windows. The jitter is the median absolute
+ * deviation of the rates, relative to the median rate.
+ */
+static void calibrate_rate(struct timer_calib *calib)
+{
+	double rates[CALIB_NWINDOWS];
+	uint64_t start_ns, end_ns, start, end;
+	size_t i;
+
+	for (i = 0; i < CALIB_NWINDOWS; ++i) {
+		start_ns = monotonic_timer.read();
+		start = read_timer();
+
+		do {
+			end_ns = monotonic_timer.read();
+		} while (end_ns - start_ns < CALIB_WINDOW_NS);
+
+		end = read_timer();
+		rates[i] = (double)(end - start) / (end_ns - start_ns);
+	}
+
+	qsort(rates, CALIB_NWINDOWS, sizeof *rates, cmp_double);
+	calib->ticks_per_ns = rates[CALIB_NWINDOWS / 2];
+
+	for (i = 0; i < CALIB_NWINDOWS; ++i) {
+		rates[i] -= calib->ticks_per_ns;
+
+		if (rates[i] < 0)
+			rates[i] = -rates[i];
+	}
+
+	qsort(rates, CALIB_NWINDOWS, sizeof *rates, cmp_double);
+	calib->jitter = calib->ticks_per_ns > 0 ?
+		rates[CALIB_NWINDOWS / 2] / calib->ticks_per_ns : 0;
+}
+
+/* Takes pairs of successive timestamps to determine the resolution and the
+ * overhead of the current timer, and measures its rate.
+ */
+int calibrate_timer(struct timer_calib *calib, size_t nsamples)
+{
+	uint64_t *deltas;
+	uint64_t past;
+	size_t i;
+
+	if (!timer || !nsamples)
+		return -1;
+
+	if (!(deltas = malloc(nsamples * sizeof *deltas)))
+		return -1;
+
+	calib->resolution = UINT64_MAX;
+
+	for (i = 0; i < nsamples; ++i) {
+		past = read_timer();
+		deltas[i] = read_timer() - past;
+
+		if (deltas[i])
+			calib->resolution = min(calib->resolution, deltas[i]);
+	}
+
+	qsort(deltas, nsamples, sizeof *deltas, cmp_uint64);
+	calib->overhead = deltas[nsamples / 2];
+
+	/* The timer did not advance at all. */
+	if (calib->resolution == UINT64_MAX)
+		calib->resolution = 0;
+
+	free(deltas);
+
+	calibrate_rate(calib);
+
+	return 0;
+}
+
+/* Makes scale_ticks() convert timestamps into nanoseconds using the rate of
+ * the given calibration.
+ */
+int set_timer_ns(struct timer_calib *calib)
+{
+	if (calib->ticks_per_ns <= 0)
+		return -1;
+
+	timer_scale = (uint64_t)((1 << TIMER_SCALE_SHIFT) /
+		calib->ticks_per_ns + 0.5);
+
+	return 0;
+}
@@ -0,0 +1,18 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdlib.h>
+
+#include "profile.h"
+
+const char *serialize_modes[] = {
+	[SERIALIZE_CPUID] = "cpuid",
+	[SERIALIZE_LFENCE] = "lfence",
+	[SERIALIZE_RDTSCP] = "rdtscp+lfence",
+	[SERIALIZE_MFENCE] = "mfence+lfence",
+	NULL,
+};
+
+int serialize_mode;
@@ -0,0 +1,54 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <stdint.h>
+
+#include <cpuid/cpuid.h>
+
+#include "macros.h"
+#include "profile.h"
+#include "timer.h"
+
+/* Checks whether the processor supports RDTSCP. */
+static int init_rdtscp(void)
+{
+	uint32_t edx;
+
+	if (cpuid_get_max_ext_leaf() < 0x80000001)
+		return -1;
+
+	asm volatile(
+		"cpuid" :
+		"=d" (edx) :
+		"a" (0x80000001) :
+		"%ebx", "%ecx");
+
+	return (edx & BIT(27)) ? 0 : -1;
+}
+
+static uint64_t read_rdtscp(void)
+{
+	return rdtscp();
+}
+
+static uint64_t read_rdtsc(void)
+{
+	return rdtsc_lfence();
+}
+
+/* Uses RDTSCP, which waits for the preceding instructions to execute. */
+struct timer rdtscp_timer = {
+	.name = "rdtscp",
+	.init = init_rdtscp,
+	.read = read_rdtscp,
+	.kind = TIMER_RDTSCP,
+};
+
+/* Uses RDTSC preceded by LFENCE to keep it from executing early. */
+struct timer rdtsc_timer = {
+	.name = "rdtsc",
+	.read = read_rdtsc,
+	.kind = TIMER_RDTSC,
+};